@@ -79,9 +79,14 @@ static void showUsage()
            "/X <filename> write stderr to file.\n"
            "/Y disable batch mode inference rules\n\n"
            "jom only options:\n"
+           "/BATCHWINDOW <ms> wait up to ms milliseconds for more batch mode targets (default 50)\n"
+           "/CONTENTHASH don't rebuild targets whose dependents have unchanged contents\n"
+           "/CRITICALPATH build targets on the longest dependency chain first\n"
            "/DUMPGRAPH show the generated dependency graph\n"
            "/DUMPGRAPHDOT dump dependency graph in dot format\n"
            "/J <n> use up to n processes in parallel\n"
+           "/NOMAKEFILECACHE always parse the makefile, don't use or write .jom_cache\n"
+           "/SEQUENTIALTARGETS build the command line targets one after another\n"
            "/VERSION print version and exit\n");
 }
 
@@ -0,0 +1,338 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of jom.
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+#include "buildlog.h"
+#include "makefile.h"
+
+#include <QtCore/QFile>
+#include <QtCore/QLockFile>
+#include <QtCore/QSaveFile>
+#include <QtCore/QtEndian>
+
+#include <cstring>
+#include <limits>
+
+namespace NMakeFile {
+
+static const char logSignature[] = "# jom build log v3\n";
+static const int logSignatureLength = sizeof(logSignature) - 1;
+
+// start time, end time, exit code, command hash, output time, effective time, check time
+// - the target name follows
+static const int fixedRecordSize = 8 + 8 + 4 + 8 + 8 + 8 + 8;
+
+// Compact the log if it contains at least this many records,
+// and less than half of them are current.
+static const int minRecordCountForCompaction = 1000;
+
+static const int lockTimeout = 10000;
+
+// Write the buffered records to the log file once this many have been appended.
+static const int maxPendingRecordCount = 64;
+
+quint32 BuildLog::Entry::duration() const
+{
+    if (endTime <= startTime)
+        return 0;
+    return quint32(qMin<qint64>(endTime - startTime, std::numeric_limits<quint32>::max()));
+}
+
+BuildLog::BuildLog()
+:   m_recordCount(0),
+    m_pendingRecordCount(0)
+{
+}
+
+BuildLog::~BuildLog()
+{
+    flush();
+}
+
+/**
+ * Returns the file name of the build log, relative to the makefile's directory.
+ */
+QString BuildLog::defaultFileName()
+{
+    return QStringLiteral(".jom_log");
+}
+
+static QString lockFileName(const QString &logFileName)
+{
+    return logFileName + QLatin1String(".lock");
+}
+
+/**
+ * Reads the build log from the given file and uses this file for subsequent appends.
+ * A non-existent file is not an error. It will be created by the first append.
+ */
+bool BuildLog::load(const QString &fileName)
+{
+    flush();
+    m_fileName = fileName;
+    m_entries.clear();
+    m_recordCount = 0;
+
+    QFile file(fileName);
+    if (!file.exists())
+        return true;
+    if (!file.open(QFile::ReadOnly))
+        return false;
+    const QByteArray data = file.readAll();
+    file.close();
+
+    if (!parse(data)
+        || (m_recordCount >= minRecordCountForCompaction && m_recordCount > 2 * m_entries.count()))
+    {
+        return compact();
+    }
+    return true;
+}
+
+/**
+ * Reads all records from data into m_entries. Later records supersede earlier ones.
+ * Returns false if data does not start with a valid signature.
+ */
+bool BuildLog::parse(const QByteArray &data)
+{
+    if (!data.startsWith(logSignature))
+        return false;
+
+    const uchar *p = reinterpret_cast<const uchar *>(data.constData()) + logSignatureLength;
+    const uchar *const end = reinterpret_cast<const uchar *>(data.constData()) + data.size();
+    while (end - p >= 4) {
+        const quint32 recordSize = qFromLittleEndian<quint32>(p);
+        p += 4;
+        if (quint32(end - p) < recordSize)
+            break;  // truncated record, written by a process that was killed
+
+        const uchar *const recordEnd = p + recordSize;
+        if (recordSize > quint32(fixedRecordSize)) {
+            Entry entry;
+            entry.startTime = qFromLittleEndian<qint64>(p);
+            entry.endTime = qFromLittleEndian<qint64>(p + 8);
+            entry.exitCode = qFromLittleEndian<qint32>(p + 16);
+            entry.commandHash = qFromLittleEndian<quint64>(p + 20);
+            entry.outputTime = qFromLittleEndian<quint64>(p + 28);
+            entry.effectiveTime = qFromLittleEndian<quint64>(p + 36);
+            entry.checkTime = qFromLittleEndian<quint64>(p + 44);
+            const char *name = reinterpret_cast<const char *>(p + fixedRecordSize);
+            m_entries.insert(QString::fromUtf8(name, int(recordEnd - p) - fixedRecordSize), entry);
+            ++m_recordCount;
+        }
+        p = recordEnd;
+    }
+    return true;
+}
+
+void BuildLog::appendRecord(QByteArray &data, const QString &key, const Entry &entry)
+{
+    const QByteArray name = key.toUtf8();
+    const int offset = data.size();
+    data.resize(offset + 4 + fixedRecordSize + name.size());
+    uchar *p = reinterpret_cast<uchar *>(data.data()) + offset;
+    qToLittleEndian<quint32>(fixedRecordSize + name.size(), p);
+    qToLittleEndian<qint64>(entry.startTime, p + 4);
+    qToLittleEndian<qint64>(entry.endTime, p + 12);
+    qToLittleEndian<qint32>(entry.exitCode, p + 20);
+    qToLittleEndian<quint64>(entry.commandHash, p + 24);
+    qToLittleEndian<quint64>(entry.outputTime, p + 32);
+    qToLittleEndian<quint64>(entry.effectiveTime, p + 40);
+    qToLittleEndian<quint64>(entry.checkTime, p + 48);
+    memcpy(p + 4 + fixedRecordSize, name.constData(), name.size());
+}
+
+/**
+ * Rewrites the log file with only the latest record of each target.
+ */
+bool BuildLog::compact()
+{
+    QLockFile lock(lockFileName(m_fileName));
+    if (!lock.tryLock(lockTimeout))
+        return false;
+
+    // Another process might have appended records since we've read the file.
+    QFile file(m_fileName);
+    if (file.open(QFile::ReadOnly)) {
+        QHash<QString, Entry> entries = m_entries;
+        m_entries.clear();
+        m_recordCount = 0;
+        if (!parse(file.readAll()))
+            m_entries = entries;
+        file.close();
+    }
+
+    QByteArray data(logSignature, logSignatureLength);
+    data.reserve(logSignatureLength + m_entries.count() * (4 + fixedRecordSize + 32));
+    QHash<QString, Entry>::const_iterator it = m_entries.constBegin();
+    for (; it != m_entries.constEnd(); ++it)
+        appendRecord(data, it.key(), it.value());
+
+    QSaveFile saveFile(m_fileName);
+    if (!saveFile.open(QIODevice::WriteOnly))
+        return false;
+    saveFile.write(data);
+    if (!saveFile.commit())
+        return false;
+
+    m_recordCount = m_entries.count();
+    return true;
+}
+
+/**
+ * Adds a record for the given target.
+ * The record is written to the log file by the next flush().
+ */
+void BuildLog::append(const QString &targetName, const Entry &entry)
+{
+    const QString key = targetName.toLower();
+    m_entries.insert(key, entry);
+    ++m_recordCount;
+    if (m_fileName.isEmpty())
+        return;
+
+    appendRecord(m_pendingRecords, key, entry);
+    if (++m_pendingRecordCount >= maxPendingRecordCount)
+        flush();
+}
+
+/**
+ * Adds records for several targets and writes them to the log file under one lock.
+ */
+void BuildLog::append(const QVector<QPair<QString, Entry> > &entries)
+{
+    typedef QPair<QString, Entry> NamedEntry;
+    foreach (const NamedEntry &namedEntry, entries) {
+        const QString key = namedEntry.first.toLower();
+        m_entries.insert(key, namedEntry.second);
+        ++m_recordCount;
+        if (!m_fileName.isEmpty()) {
+            appendRecord(m_pendingRecords, key, namedEntry.second);
+            ++m_pendingRecordCount;
+        }
+    }
+    flush();
+}
+
+/**
+ * Writes the buffered records to the log file under one lock.
+ */
+bool BuildLog::flush()
+{
+    if (m_pendingRecords.isEmpty())
+        return true;
+
+    // Records that cannot be written are dropped. They are only missing from future runs.
+    QByteArray records;
+    records.swap(m_pendingRecords);
+    m_pendingRecordCount = 0;
+
+    QLockFile lock(lockFileName(m_fileName));
+    if (!lock.tryLock(lockTimeout))
+        return false;
+
+    QFile file(m_fileName);
+    if (!file.open(QFile::WriteOnly | QFile::Append))
+        return false;
+    if (file.size() == 0)
+        file.write(logSignature, logSignatureLength);
+    return file.write(records) == records.size();
+}
+
+/**
+ * Returns the latest record of the given target or 0 if there's none.
+ */
+const BuildLog::Entry *BuildLog::entry(const QString &targetName) const
+{
+    QHash<QString, Entry>::const_iterator it = m_entries.find(targetName.toLower());
+    if (it == m_entries.constEnd())
+        return 0;
+    return &it.value();
+}
+
+/**
+ * Returns the durations in milliseconds of the last successful executions.
+ * The keys are lower case target names.
+ * Records without a start time were added for up-to-date targets and carry
+ * only the command hash.
+ */
+QHash<QString, quint32> BuildLog::targetDurations() const
+{
+    QHash<QString, quint32> result;
+    result.reserve(m_entries.count());
+    QHash<QString, Entry>::const_iterator it = m_entries.constBegin();
+    for (; it != m_entries.constEnd(); ++it) {
+        if (it->exitCode == 0 && it->startTime != 0)
+            result.insert(it.key(), it->duration());
+    }
+    return result;
+}
+
+static inline void hashData(quint64 &h, const QString &str)
+{
+    const uchar *p = reinterpret_cast<const uchar *>(str.constData());
+    const uchar *const end = p + str.size() * sizeof(QChar);
+    for (; p != end; ++p) {
+        h ^= *p;
+        h *= Q_UINT64_C(0x100000001b3);
+    }
+
+    // terminate each string to distinguish "ab", "c" from "a", "bc"
+    h ^= 0xff;
+    h *= Q_UINT64_C(0x100000001b3);
+}
+
+/**
+ * Returns a hash value of the command lines and inline files.
+ * The value is stable across jom runs (FNV-1a).
+ */
+quint64 BuildLog::hashCommands(const QList<Command> &commands)
+{
+    quint64 h = Q_UINT64_C(0xcbf29ce484222325);
+    foreach (const Command &command, commands) {
+        hashData(h, command.m_commandLine);
+        foreach (const InlineFile *inlineFile, command.m_inlineFiles) {
+            hashData(h, inlineFile->m_filename);
+            hashData(h, inlineFile->m_content);
+        }
+    }
+    return h;
+}
+
+/**
+ * Returns a hash value of a target's commands, given the hash of its commands before
+ * the file name macros were expanded. The file name macros are determined by the
+ * target name and the dependents.
+ */
+quint64 BuildLog::hashTargetCommands(quint64 commandsHash, const QString &targetName,
+                                     const QStringList &dependents)
+{
+    quint64 h = commandsHash;
+    hashData(h, targetName);
+    foreach (const QString &dependent, dependents)
+        hashData(h, dependent);
+    return h;
+}
+
+} // namespace NMakeFile
@@ -0,0 +1,108 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of jom.
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+#ifndef BUILDLOG_H
+#define BUILDLOG_H
+
+#include <QtCore/QByteArray>
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QPair>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+#include <QtCore/QVector>
+
+namespace NMakeFile {
+
+class Command;
+
+/**
+ * Persistent history of executed targets.
+ *
+ * The log is an append-only binary file that lives next to the makefile.
+ * Every executed description block adds one record. Older records of the same
+ * target are superseded and removed when the log is compacted on load.
+ * New records are buffered and written in batches by flush().
+ * Writers serialize through a lock file, so several jom processes can share one log.
+ */
+class BuildLog
+{
+public:
+    struct Entry
+    {
+        Entry()
+            : startTime(0), endTime(0), exitCode(0), commandHash(0),
+              outputTime(0), effectiveTime(0), checkTime(0)
+        {}
+
+        quint32 duration() const;
+
+        qint64 startTime;       // milliseconds since epoch
+        qint64 endTime;         // milliseconds since epoch
+        int exitCode;
+        quint64 commandHash;
+
+        // Set if the .RESTAT check found the target's file unchanged.
+        // The values are internal representations of FileTime.
+        quint64 outputTime;     // time stamp of the file after the check, 0 if not set
+        quint64 effectiveTime;  // time stamp the targets depending on the file see
+        quint64 checkTime;      // time the dependents of the target were up-to-date
+    };
+
+    BuildLog();
+    ~BuildLog();
+
+    static QString defaultFileName();
+
+    bool load(const QString &fileName);
+    bool isLoaded() const { return !m_fileName.isEmpty(); }
+    const QString &fileName() const { return m_fileName; }
+    void append(const QString &targetName, const Entry &entry);
+    void append(const QVector<QPair<QString, Entry> > &entries);
+    bool flush();
+    const Entry *entry(const QString &targetName) const;
+    QHash<QString, quint32> targetDurations() const;
+    int count() const { return m_entries.count(); }
+
+    static quint64 hashCommands(const QList<Command> &commands);
+    static quint64 hashTargetCommands(quint64 commandsHash, const QString &targetName,
+                                      const QStringList &dependents);
+
+private:
+    bool parse(const QByteArray &data);
+    bool compact();
+    static void appendRecord(QByteArray &data, const QString &key, const Entry &entry);
+
+private:
+    QString m_fileName;
+    QHash<QString, Entry> m_entries;    // keys are lower case target names
+    int m_recordCount;
+    QByteArray m_pendingRecords;        // appended records that are not yet written
+    int m_pendingRecordCount;
+};
+
+} // namespace NMakeFile
+
+#endif // BUILDLOG_H
@@ -24,14 +24,15 @@
 ****************************************************************************/
 
 #include "commandexecutor.h"
+#include "buildlog.h"
 #include "options.h"
 #include "exception.h"
 #include "helperfunctions.h"
 #include "fastfileinfo.h"
 
+#include <QtCore/QDateTime>
 #include <QtCore/QDebug>
 #include <QtCore/QDir>
-#include <QtCore/QRegExp>
 #include <QStringList>
 #include <windows.h>
 
@@ -40,9 +41,14 @@ namespace NMakeFile {
 ulong CommandExecutor::m_startUpTickCount = 0;
 QString CommandExecutor::m_tempPath;
 
-CommandExecutor::CommandExecutor(QObject* parent, const ProcessEnvironment &environment)
+CommandExecutor::CommandExecutor(QObject* parent, const ProcessEnvironment &environment,
+                                 BuildLog *buildLog)
 :   QObject(parent),
     m_pTarget(0),
+    m_buildLog(buildLog),
+    m_exitCode(0),
+    m_startTime(0),
+    m_commandHash(0),
     m_ignoreProcessErrors(false),
     m_active(false)
 {
@@ -72,6 +78,7 @@ void CommandExecutor::start(DescriptionBlock* target)
 {
     m_pTarget = target;
     m_active = true;
+    m_exitCode = 0;
 
     if (target->m_commands.isEmpty()) {
         finishExecution(false);
@@ -79,6 +86,9 @@ void CommandExecutor::start(DescriptionBlock* target)
     }
 
     target->expandFileNameMacros();
+    m_commandHash = target->m_commandHash
+            ? target->m_commandHash : BuildLog::hashCommands(target->m_commands);
+    m_startTime = QDateTime::currentMSecsSinceEpoch();
     cleanupTempFiles();
     createTempFiles();
 
@@ -101,6 +111,7 @@ void CommandExecutor::onProcessFinished(int exitCode, Process::ExitStatus exitSt
     //qDebug() << "onProcessFinished" << m_pTarget->m_targetName;
     if (exitStatus != Process::NormalExit)
         exitCode = 2;
+    m_exitCode = exitCode;
 
     const Command &currentCommand = m_pTarget->m_commands.at(m_currentCommandIdx);
     if (static_cast<unsigned int>(exitCode) > currentCommand.m_maxExitCode) {
@@ -127,6 +138,29 @@ void CommandExecutor::onProcessFinished(int exitCode, Process::ExitStatus exitSt
 void CommandExecutor::finishExecution(bool commandFailed)
 {
     m_active = false;
+    if (m_buildLog && m_buildLog->isLoaded() && !m_pTarget->m_commands.isEmpty()
+        && !m_pTarget->makefile()->options()->dryRun)
+    {
+        BuildLog::Entry entry;
+        entry.startTime = m_startTime;
+        entry.endTime = QDateTime::currentMSecsSinceEpoch();
+        // Exit codes of commands whose errors are ignored don't make the target fail.
+        entry.exitCode = commandFailed ? m_exitCode : 0;
+        entry.commandHash = m_commandHash;
+        const QStringList &batchTargetNames = m_pTarget->m_batchTargetNames;
+        if (!batchTargetNames.isEmpty()) {
+            // Record each file's share of the batch to size future batches.
+            entry.endTime = entry.startTime
+                    + (entry.endTime - entry.startTime) / (batchTargetNames.count() + 1);
+            foreach (const QString &batchTargetName, batchTargetNames) {
+                const DescriptionBlock *batchTarget = m_pTarget->makefile()->target(batchTargetName);
+                entry.commandHash = batchTarget ? batchTarget->m_commandHash : 0;
+                m_buildLog->append(batchTargetName, entry);
+            }
+            entry.commandHash = m_commandHash;
+        }
+        m_buildLog->append(m_pTarget->targetName(), entry);
+    }
     emit finished(this, commandFailed);
 }
 
@@ -144,11 +178,50 @@ inline bool commandLineStartsWithCommand(const QString &str, const QString &sear
 
 static bool startsWithShellBuiltin(const QString &commandLine)
 {
-    static QRegExp rex(QLatin1String(
-        "^(assoc|break|call|chdir|cd|cls|color|copy|del|dir|echo|endlocal|erase|exit|for|ftype|goto"
-        "|if|md|move|path|pause|popd|prompt|pushd|ren|rename|setlocal|shift|time|title|type|ver|verify|vol)\\s"
-        ), Qt::CaseInsensitive, QRegExp::RegExp2);
-    return rex.indexIn(commandLine) >= 0;
+    // must be sorted
+    static const char * const builtins[] = {
+        "assoc", "break", "call", "cd", "chdir", "cls", "color", "copy", "del", "dir", "echo",
+        "endlocal", "erase", "exit", "for", "ftype", "goto", "if", "md", "move", "path", "pause",
+        "popd", "prompt", "pushd", "ren", "rename", "setlocal", "shift", "time", "title", "type",
+        "ver", "verify", "vol"
+    };
+
+    char word[16];
+    int length = 0;
+    for (;; ++length) {
+        if (length == commandLine.length() || length == int(sizeof(word)))
+            return false;
+        const QChar ch = commandLine.at(length);
+        if (ch.isSpace())
+            break;
+        ushort c = ch.unicode();
+        if (c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+        if (c < 'a' || c > 'z')
+            return false;
+        word[length] = char(c);
+    }
+    word[length] = '\0';
+
+    int low = 0;
+    int high = int(sizeof(builtins) / sizeof(builtins[0])) - 1;
+    while (low <= high) {
+        const int mid = (low + high) / 2;
+        const int cmp = qstrcmp(builtins[mid], word);
+        if (cmp == 0)
+            return true;
+        if (cmp < 0)
+            low = mid + 1;
+        else
+            high = mid - 1;
+    }
+    return false;
+}
+
+static bool isShellComment(const QString &commandLine)
+{
+    return commandLine.startsWith(QLatin1Char(':'))
+        || commandLineStartsWithCommand(commandLine, QLatin1String("rem"));
 }
 
 void CommandExecutor::executeCurrentCommandLine()
@@ -168,9 +241,7 @@ void CommandExecutor::executeCurrentCommandLine()
     // Unescape commandline characters.
     commandLine.replace(QLatin1String("%%"), QLatin1String("%"));
 
-    static QRegExp rexShellComment(QLatin1String("^(:|rem\\s)"),
-                                   Qt::CaseInsensitive, QRegExp::RegExp2);
-    if (m_pTarget->makefile()->options()->dryRun || (rexShellComment.indexIn(commandLine) >= 0))
+    if (m_pTarget->makefile()->options()->dryRun || isShellComment(commandLine))
     {
         onProcessFinished(0, Process::NormalExit);
         return;
@@ -344,8 +415,16 @@ void CommandExecutor::writeToStandardError(const QByteArray& output)
 
 bool CommandExecutor::isSimpleCommandLine(const QString &commandLine)
 {
-    static QRegExp rex(QLatin1String("\\||>|<|&"));
-    return rex.indexIn(commandLine) == -1;
+    for (const QChar *ch = commandLine.constData(), *end = ch + commandLine.length(); ch != end; ++ch) {
+        switch (ch->unicode()) {
+        case '|':
+        case '>':
+        case '<':
+        case '&':
+            return false;
+        }
+    }
+    return true;
 }
 
 bool CommandExecutor::exec_cd(const QString &commandLine)
@@ -37,11 +37,13 @@ QT_END_NAMESPACE
 
 namespace NMakeFile {
 
+class BuildLog;
+
 class CommandExecutor : public QObject
 {
     Q_OBJECT
 public:
-    CommandExecutor(QObject* parent, const ProcessEnvironment &environment);
+    CommandExecutor(QObject* parent, const ProcessEnvironment &environment, BuildLog *buildLog);
     ~CommandExecutor();
 
     void start(DescriptionBlock* target);
@@ -78,6 +80,7 @@ private:
     static QString      m_tempPath;
     Process             m_process;
     DescriptionBlock*   m_pTarget;
+    BuildLog*           m_buildLog;
 
     struct TempFile
     {
@@ -87,6 +90,9 @@ private:
 
     QList<TempFile>     m_tempFiles;
     int                 m_currentCommandIdx;
+    int                 m_exitCode;
+    qint64              m_startTime;
+    quint64             m_commandHash;
     QString             m_nextWorkingDir;
     bool                m_ignoreProcessErrors;
     bool                m_active;
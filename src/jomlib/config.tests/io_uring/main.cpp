@@ -0,0 +1,55 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of jom.
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+
+// Checks that the kernel headers support statx and probing through io_uring.
+
+#include <linux/io_uring.h>
+
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+int main()
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    const bool singleMapping = params.features & IORING_FEAT_SINGLE_MMAP;
+
+    struct io_uring_sqe sqe;
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_STATX;
+    sqe.len = STATX_MTIME | STATX_SIZE;
+    sqe.statx_flags = 0;
+
+    struct io_uring_probe_op probeOp;
+    probeOp.flags = IO_URING_OP_SUPPORTED;
+    const int probeSize = int(sizeof(struct io_uring_probe)) + int(sizeof(probeOp));
+
+    struct statx stx;
+    stx.stx_mtime.tv_nsec = 0;
+    return int(singleMapping) + int(sizeof(stx)) + probeSize + IORING_REGISTER_PROBE
+            + __NR_io_uring_setup + __NR_io_uring_enter + __NR_io_uring_register;
+}
@@ -0,0 +1,469 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of jom.
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+
+#include "contenthashes.h"
+#include "fastfileinfo.h"
+#include "makefile.h"
+
+#include <QtCore/QFile>
+#include <QtCore/QLockFile>
+#include <QtCore/QRunnable>
+#include <QtCore/QSaveFile>
+#include <QtCore/QStringList>
+#include <QtCore/QThread>
+#include <QtCore/QThreadPool>
+#include <QtCore/QVector>
+#include <QtCore/QtEndian>
+
+#include <cstring>
+
+namespace NMakeFile {
+
+static const char databaseSignature[] = "# jom content hashes v1\n";
+static const int databaseSignatureLength = sizeof(databaseSignature) - 1;
+
+// record kind, then last write time, size and hash for files or hash for targets
+static const int fileRecordSize = 1 + 8 + 8 + 8;
+static const int targetRecordSize = 1 + 8;
+static const uchar fileRecordKind = 'F';
+static const uchar targetRecordKind = 'T';
+
+static const int lockTimeout = 10000;
+
+ContentHashes::ContentHashes()
+:   m_dirty(false)
+{
+}
+
+/**
+ * Returns the file name of the database, relative to the makefile's directory.
+ */
+QString ContentHashes::defaultFileName()
+{
+    return QStringLiteral(".jom_hashes");
+}
+
+static QString lockFileName(const QString &databaseFileName)
+{
+    return databaseFileName + QLatin1String(".lock");
+}
+
+/**
+ * Reads the database from the given file and uses this file for save().
+ * A non-existent file is not an error.
+ */
+bool ContentHashes::load(const QString &fileName)
+{
+    m_fileName = fileName;
+    m_files.clear();
+    m_targets.clear();
+    m_dirty = false;
+
+    QFile file(fileName);
+    if (!file.exists())
+        return true;
+    if (!file.open(QFile::ReadOnly))
+        return false;
+    return parse(file.readAll(), m_files, m_targets);
+}
+
+bool ContentHashes::parse(const QByteArray &data, QHash<QString, FileRecord> &files,
+                          QHash<QString, quint64> &targets) const
+{
+    if (!data.startsWith(databaseSignature))
+        return false;
+
+    const uchar *p = reinterpret_cast<const uchar *>(data.constData()) + databaseSignatureLength;
+    const uchar *const end = reinterpret_cast<const uchar *>(data.constData()) + data.size();
+    while (end - p >= 4) {
+        const quint32 recordSize = qFromLittleEndian<quint32>(p);
+        p += 4;
+        if (recordSize == 0 || quint32(end - p) < recordSize)
+            break;
+
+        const uchar *const recordEnd = p + recordSize;
+        const char *name;
+        if (*p == fileRecordKind && recordSize > quint32(fileRecordSize)) {
+            FileRecord record;
+            record.lastWriteTime = qFromLittleEndian<quint64>(p + 1);
+            record.size = qFromLittleEndian<qint64>(p + 9);
+            record.hash = qFromLittleEndian<quint64>(p + 17);
+            name = reinterpret_cast<const char *>(p + fileRecordSize);
+            files.insert(QString::fromUtf8(name, int(recordEnd - p) - fileRecordSize), record);
+        } else if (*p == targetRecordKind && recordSize > quint32(targetRecordSize)) {
+            const quint64 hash = qFromLittleEndian<quint64>(p + 1);
+            name = reinterpret_cast<const char *>(p + targetRecordSize);
+            targets.insert(QString::fromUtf8(name, int(recordEnd - p) - targetRecordSize), hash);
+        }
+        p = recordEnd;
+    }
+    return true;
+}
+
+static uchar *appendRecord(QByteArray &data, int fixedSize, uchar kind, const QByteArray &name)
+{
+    const int offset = data.size();
+    data.resize(offset + 4 + fixedSize + name.size());
+    uchar *p = reinterpret_cast<uchar *>(data.data()) + offset;
+    qToLittleEndian<quint32>(fixedSize + name.size(), p);
+    p[4] = kind;
+    memcpy(p + 4 + fixedSize, name.constData(), name.size());
+    return p + 5;
+}
+
+/**
+ * Writes the database if it has changed.
+ * Records that other jom processes have written in the meantime are kept,
+ * unless this process has newer ones.
+ */
+bool ContentHashes::save()
+{
+    if (!m_dirty || m_fileName.isEmpty())
+        return true;
+
+    QLockFile lock(lockFileName(m_fileName));
+    if (!lock.tryLock(lockTimeout))
+        return false;
+
+    QHash<QString, FileRecord> files;
+    QHash<QString, quint64> targets;
+    QFile file(m_fileName);
+    if (file.open(QFile::ReadOnly)) {
+        parse(file.readAll(), files, targets);
+        file.close();
+    }
+    for (QHash<QString, FileRecord>::const_iterator it = m_files.constBegin();
+         it != m_files.constEnd(); ++it)
+    {
+        files.insert(it.key(), it.value());
+    }
+    for (QHash<QString, quint64>::const_iterator it = m_targets.constBegin();
+         it != m_targets.constEnd(); ++it)
+    {
+        targets.insert(it.key(), it.value());
+    }
+
+    QByteArray data(databaseSignature, databaseSignatureLength);
+    data.reserve(databaseSignatureLength + files.count() * (4 + fileRecordSize + 32)
+                 + targets.count() * (4 + targetRecordSize + 32));
+    for (QHash<QString, FileRecord>::const_iterator it = files.constBegin();
+         it != files.constEnd(); ++it)
+    {
+        uchar *p = appendRecord(data, fileRecordSize, fileRecordKind, it.key().toUtf8());
+        qToLittleEndian<quint64>(it->lastWriteTime, p);
+        qToLittleEndian<qint64>(it->size, p + 8);
+        qToLittleEndian<quint64>(it->hash, p + 16);
+    }
+    for (QHash<QString, quint64>::const_iterator it = targets.constBegin();
+         it != targets.constEnd(); ++it)
+    {
+        uchar *p = appendRecord(data, targetRecordSize, targetRecordKind, it.key().toUtf8());
+        qToLittleEndian<quint64>(it.value(), p);
+    }
+
+    QSaveFile saveFile(m_fileName);
+    if (!saveFile.open(QIODevice::WriteOnly))
+        return false;
+    saveFile.write(data);
+    if (!saveFile.commit())
+        return false;
+
+    m_dirty = false;
+    return true;
+}
+
+namespace {
+
+struct HashJob
+{
+    QString fileName;
+    FileTime::InternalType lastWriteTime;
+    qint64 size;
+    quint64 hash;
+    bool ok;
+};
+
+class HashFilesTask : public QRunnable
+{
+public:
+    HashFilesTask(HashJob *jobs, int begin, int end)
+        : m_jobs(jobs), m_begin(begin), m_end(end)
+    {
+    }
+
+    void run()
+    {
+        for (int i = m_begin; i < m_end; ++i)
+            m_jobs[i].ok = ContentHashes::hashFile(m_jobs[i].fileName, &m_jobs[i].hash);
+    }
+
+private:
+    HashJob *const m_jobs;
+    const int m_begin;
+    const int m_end;
+};
+
+} // anonymous namespace
+
+/**
+ * Hashes all given files that are not in the database or that have changed
+ * since they were hashed. The files are read concurrently.
+ */
+void ContentHashes::prefetch(const QStringList &fileNames)
+{
+    QVector<HashJob> jobs;
+    foreach (const QString &fileName, fileNames) {
+        const FastFileInfo fi(fileName);
+        if (!fi.exists())
+            continue;
+        const FileTime::InternalType lastWriteTime = fi.lastModified().internalRepresentation();
+        QHash<QString, FileRecord>::const_iterator it = m_files.constFind(fileName);
+        if (it != m_files.constEnd() && it->lastWriteTime == lastWriteTime && it->size == fi.size())
+            continue;
+        HashJob job;
+        job.fileName = fileName;
+        job.lastWriteTime = lastWriteTime;
+        job.size = fi.size();
+        job.hash = 0;
+        job.ok = false;
+        jobs.append(job);
+    }
+    if (jobs.isEmpty())
+        return;
+
+    QThreadPool threadPool;
+    threadPool.setMaxThreadCount(QThread::idealThreadCount());
+    const int count = jobs.count();
+    const int filesPerTask = qMax(1, count / (4 * threadPool.maxThreadCount()));
+    for (int begin = 0; begin < count; begin += filesPerTask)
+        threadPool.start(new HashFilesTask(jobs.data(), begin, qMin(begin + filesPerTask, count)));
+    threadPool.waitForDone();
+
+    foreach (const HashJob &job, jobs) {
+        if (!job.ok)
+            continue;
+        FileRecord record;
+        record.lastWriteTime = job.lastWriteTime;
+        record.size = job.size;
+        record.hash = job.hash;
+        m_files.insert(job.fileName, record);
+        m_dirty = true;
+    }
+}
+
+/**
+ * Retrieves the content hash of the file.
+ * The file is only read if its modification time or size differ from the database.
+ * Returns false if the file cannot be read.
+ */
+bool ContentHashes::fileHash(const QString &fileName, quint64 *hash)
+{
+    const FastFileInfo fi(fileName);
+    if (!fi.exists())
+        return false;
+
+    const FileTime::InternalType lastWriteTime = fi.lastModified().internalRepresentation();
+    QHash<QString, FileRecord>::iterator it = m_files.find(fileName);
+    if (it != m_files.end() && it->lastWriteTime == lastWriteTime && it->size == fi.size()) {
+        *hash = it->hash;
+        return true;
+    }
+
+    FileRecord record;
+    if (!hashFile(fileName, &record.hash))
+        return false;
+    record.lastWriteTime = lastWriteTime;
+    record.size = fi.size();
+    m_files.insert(fileName, record);
+    m_dirty = true;
+    *hash = record.hash;
+    return true;
+}
+
+/**
+ * Calculates a hash over the names and contents of the dependents of the target.
+ * Returns false if a dependent cannot be read.
+ */
+bool ContentHashes::inputHash(DescriptionBlock *target, quint64 *hash)
+{
+    quint64 h = 0;
+    foreach (const QString &dependentName, target->m_dependents) {
+        quint64 dependentHash;
+        if (!fileHash(dependentName, &dependentHash))
+            return false;
+        h = hashData(reinterpret_cast<const char *>(dependentName.constData()),
+                     dependentName.size() * sizeof(QChar), h);
+        h = hashData(reinterpret_cast<const char *>(&dependentHash), sizeof(dependentHash), h);
+    }
+    *hash = h;
+    return true;
+}
+
+/**
+ * Returns true if the dependents of the target have the same contents
+ * as when the target was recorded.
+ */
+bool ContentHashes::isTargetUnchanged(DescriptionBlock *target)
+{
+    QHash<QString, quint64>::const_iterator it = m_targets.constFind(target->targetName().toLower());
+    if (it == m_targets.constEnd())
+        return false;
+    quint64 hash;
+    return inputHash(target, &hash) && hash == it.value();
+}
+
+bool ContentHashes::hasTargetRecord(const DescriptionBlock *target) const
+{
+    return m_targets.contains(target->targetName().toLower());
+}
+
+/**
+ * Records the content hashes of the target's dependents.
+ * Must be called after the target has been built successfully.
+ */
+void ContentHashes::recordTarget(DescriptionBlock *target)
+{
+    const QString key = target->targetName().toLower();
+    quint64 hash;
+    if (!target->m_dependents.isEmpty() && inputHash(target, &hash)) {
+        QHash<QString, quint64>::iterator it = m_targets.find(key);
+        if (it != m_targets.end() && it.value() == hash)
+            return;
+        m_targets.insert(key, hash);
+        m_dirty = true;
+    } else if (m_targets.remove(key)) {
+        m_dirty = true;
+    }
+}
+
+static const quint64 prime1 = Q_UINT64_C(11400714785074694791);
+static const quint64 prime2 = Q_UINT64_C(14029467366897019727);
+static const quint64 prime3 = Q_UINT64_C(1609587929392839161);
+static const quint64 prime4 = Q_UINT64_C(9650029242287828579);
+static const quint64 prime5 = Q_UINT64_C(2870177450012600261);
+
+static inline quint64 rotateLeft(quint64 x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline quint64 accumulate(quint64 acc, quint64 input)
+{
+    acc += input * prime2;
+    acc = rotateLeft(acc, 31);
+    return acc * prime1;
+}
+
+static inline quint64 mergeRound(quint64 acc, quint64 val)
+{
+    acc ^= accumulate(0, val);
+    return acc * prime1 + prime4;
+}
+
+/**
+ * Returns the XXH64 hash of the data.
+ */
+quint64 ContentHashes::hashData(const char *data, qint64 size, quint64 seed)
+{
+    const uchar *p = reinterpret_cast<const uchar *>(data);
+    const uchar *const end = p + size;
+    quint64 h;
+
+    if (size >= 32) {
+        const uchar *const limit = end - 32;
+        quint64 v1 = seed + prime1 + prime2;
+        quint64 v2 = seed + prime2;
+        quint64 v3 = seed;
+        quint64 v4 = seed - prime1;
+        do {
+            v1 = accumulate(v1, qFromLittleEndian<quint64>(p));
+            v2 = accumulate(v2, qFromLittleEndian<quint64>(p + 8));
+            v3 = accumulate(v3, qFromLittleEndian<quint64>(p + 16));
+            v4 = accumulate(v4, qFromLittleEndian<quint64>(p + 24));
+            p += 32;
+        } while (p <= limit);
+
+        h = rotateLeft(v1, 1) + rotateLeft(v2, 7) + rotateLeft(v3, 12) + rotateLeft(v4, 18);
+        h = mergeRound(h, v1);
+        h = mergeRound(h, v2);
+        h = mergeRound(h, v3);
+        h = mergeRound(h, v4);
+    } else {
+        h = seed + prime5;
+    }
+
+    h += quint64(size);
+    for (; end - p >= 8; p += 8) {
+        h ^= accumulate(0, qFromLittleEndian<quint64>(p));
+        h = rotateLeft(h, 27) * prime1 + prime4;
+    }
+    if (end - p >= 4) {
+        h ^= quint64(qFromLittleEndian<quint32>(p)) * prime1;
+        h = rotateLeft(h, 23) * prime2 + prime3;
+        p += 4;
+    }
+    for (; p < end; ++p) {
+        h ^= *p * prime5;
+        h = rotateLeft(h, 11) * prime1;
+    }
+
+    h ^= h >> 33;
+    h *= prime2;
+    h ^= h >> 29;
+    h *= prime3;
+    h ^= h >> 32;
+    return h;
+}
+
+/**
+ * Calculates the content hash of the file. The file is memory mapped if possible.
+ */
+bool ContentHashes::hashFile(const QString &fileName, quint64 *hash)
+{
+    QFile file(fileName);
+    if (!file.open(QFile::ReadOnly))
+        return false;
+
+    const qint64 size = file.size();
+    if (size == 0) {
+        *hash = hashData(0, 0);
+        return true;
+    }
+
+    if (const uchar *data = file.map(0, size)) {
+        *hash = hashData(reinterpret_cast<const char *>(data), size);
+        file.unmap(const_cast<uchar *>(data));
+        return true;
+    }
+
+    const QByteArray content = file.readAll();
+    if (content.size() != size)
+        return false;
+    *hash = hashData(content.constData(), content.size());
+    return true;
+}
+
+} // namespace NMakeFile
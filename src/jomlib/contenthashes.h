@@ -0,0 +1,94 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of jom.
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+
+#ifndef CONTENTHASHES_H
+#define CONTENTHASHES_H
+
+#include "filetime.h"
+
+#include <QtCore/QHash>
+#include <QtCore/QString>
+
+QT_BEGIN_NAMESPACE
+class QByteArray;
+class QStringList;
+QT_END_NAMESPACE
+
+namespace NMakeFile {
+
+class DescriptionBlock;
+
+/**
+ * Persistent database of file content hashes for the /CONTENTHASH mode.
+ *
+ * For every file it records the content hash together with the modification time and
+ * size the file had when it was hashed. A file is only read again if one of them changed.
+ * For every target it records a hash over the content hashes of its dependents at the
+ * time it was built. A target whose dependents are newer but have the same contents
+ * is considered up-to-date.
+ */
+class ContentHashes
+{
+public:
+    ContentHashes();
+
+    static QString defaultFileName();
+
+    bool load(const QString &fileName);
+    bool save();
+    const QString &fileName() const { return m_fileName; }
+
+    void prefetch(const QStringList &fileNames);
+    bool fileHash(const QString &fileName, quint64 *hash);
+    bool isTargetUnchanged(DescriptionBlock *target);
+    bool hasTargetRecord(const DescriptionBlock *target) const;
+    void recordTarget(DescriptionBlock *target);
+
+    static quint64 hashData(const char *data, qint64 size, quint64 seed = 0);
+    static bool hashFile(const QString &fileName, quint64 *hash);
+
+private:
+    struct FileRecord
+    {
+        FileTime::InternalType lastWriteTime;
+        qint64 size;
+        quint64 hash;
+    };
+
+    bool inputHash(DescriptionBlock *target, quint64 *hash);
+    bool parse(const QByteArray &data, QHash<QString, FileRecord> &files,
+               QHash<QString, quint64> &targets) const;
+
+private:
+    QString m_fileName;
+    QHash<QString, FileRecord> m_files;     // by file name as written in the makefile
+    QHash<QString, quint64> m_targets;      // by lower case target name
+    bool m_dirty;
+};
+
+} // namespace NMakeFile
+
+#endif // CONTENTHASHES_H
@@ -27,16 +27,48 @@
 #include "makefile.h"
 #include "options.h"
 #include "fastfileinfo.h"
+#include "contenthashes.h"
+#include "buildlog.h"
 
 #include <QFile>
 #include <QDebug>
-#include <QDir>
+
+#include <algorithm>
 
 namespace NMakeFile {
 
+/**
+ * Orders node ids for the ready heap.
+ * Nodes with equal priority are handed out in the order they became ready.
+ */
+class DependencyGraph::PriorityLessThan
+{
+public:
+    PriorityLessThan(const QVector<Node> &nodes)
+        : m_nodes(nodes)
+    {
+    }
+
+    bool operator()(NodeId lhs, NodeId rhs) const
+    {
+        const Node &l = m_nodes.at(lhs);
+        const Node &r = m_nodes.at(rhs);
+        if (l.priority != r.priority)
+            return l.priority < r.priority;
+        return l.readySequenceNumber > r.readySequenceNumber;
+    }
+
+private:
+    const QVector<Node> &m_nodes;
+};
+
 DependencyGraph::DependencyGraph()
-:   m_root(0),
-    m_bDirtyLeaves(true)
+:   m_nodeCount(0),
+    m_discardedUnbuildableCount(0),
+    m_readySequenceNumber(0),
+    m_criticalPathScheduling(false),
+    m_contentHashes(0),
+    m_buildLog(0)
 {
 }
 
@@ -45,67 +77,211 @@ DependencyGraph::~DependencyGraph()
     clear();
 }
 
-DependencyGraph::Node* DependencyGraph::createNode(DescriptionBlock* target, Node* parent)
+/**
+ * Returns the id of the target's node or InvalidNodeId if the target is not in the graph.
+ */
+DependencyGraph::NodeId DependencyGraph::nodeId(DescriptionBlock *target) const
 {
-    Node* node = new Node;
-    node->target = target;
-    node->state = Node::UnknownState;
-    if (parent) {
-        addEdge(parent, node);
-    }
+    const NodeId id = target->m_graphNodeId;
+    if (id < NodeId(m_nodes.count()) && m_nodes.at(id).target == target)
+        return id;
+    return InvalidNodeId;
+}
 
-    m_nodeContainer[target] = node;
-    return node;
+DependencyGraph::NodeId DependencyGraph::createNode(DescriptionBlock* target)
+{
+    Node node;
+    node.target = target;
+    node.priority = 0;
+    node.firstChild = 0;
+    node.childCount = 0;
+    node.firstParent = 0;
+    node.parentCount = 0;
+    node.pendingChildren = 0;
+    node.readySequenceNumber = 0;
+    node.lastParent = InvalidNodeId;
+    node.state = Node::UnknownState;
+    node.expanded = false;
+
+    const NodeId id = m_nodes.count();
+    m_nodes.append(node);
+    target->m_graphNodeId = id;
+    ++m_nodeCount;
+    return id;
 }
 
-void DependencyGraph::deleteNode(Node* node)
+void DependencyGraph::deleteNode(NodeId id)
 {
-    m_nodeContainer.remove(node->target);
-    if (node == m_root) m_root = 0;
-    delete node;
+    m_nodes[id].state = Node::Removed;
+    --m_nodeCount;
 }
 
-void DependencyGraph::build(DescriptionBlock* target)
+/**
+ * Builds one graph that contains all given targets as roots.
+ * Dependencies shared between the targets are represented by a single node
+ * and are therefore built only once.
+ */
+void DependencyGraph::build(const QList<DescriptionBlock*> &targets)
 {
-    m_bDirtyLeaves = true;
-    m_root = createNode(target, 0);
-    QSet<Node *> seen;
-    internalBuild(m_root, seen);
-    //dump();
-    //qDebug() << "\n\n-------------------------------------------------\n";
+    Q_ASSERT(m_nodes.isEmpty());
+    if (targets.isEmpty())
+        return;
+
+    m_criticalPathScheduling = targets.first()->makefile()->options()->scheduleCriticalPathFirst;
+    QVector<NodeId> postOrder;
+    foreach (DescriptionBlock *target, targets) {
+        if (nodeId(target) != InvalidNodeId)
+            continue;
+        const NodeId root = createNode(target);
+        m_roots.append(root);
+        internalBuild(root, postOrder);
+    }
+    buildParentEdges();
+    if (m_criticalPathScheduling)
+        calculatePriorities(postOrder);
+}
 
-    //do {
-    //    target = findAvailableTarget();
-    //    if (target) qDebug() << "XXX" << target->m_targetName << target->m_bFileExists;
-    //} while(target);
+/**
+ * Sets the durations in milliseconds of previous executions of targets.
+ * The keys are lower case target names.
+ * The durations are used as node weights for critical path scheduling
+ * and as costs for sizing batches of batch mode inference rules.
+ */
+void DependencyGraph::setTargetDurations(const QHash<QString, quint32> &durations)
+{
+    m_targetDurations = durations;
+}
 
-    //qDebug() << "\nFINISHED";
+quint32 DependencyGraph::targetWeight(DescriptionBlock *target, quint32 defaultWeight) const
+{
+    if (target->m_commands.isEmpty() && target->m_inferenceRules.isEmpty())
+        return 0;
+    return m_targetDurations.value(target->targetName().toLower(), defaultWeight);
 }
 
-void DependencyGraph::markParentsRecursivlyUnbuildable(DescriptionBlock *target)
+/**
+ * Assigns each node the length of the longest weighted path from the root to the node.
+ * The weight of a node is its recorded duration. Targets without a recorded duration
+ * get the average of all recorded durations.
+ *
+ * The nodes are passed in post-order. Iterating backwards guarantees that all parents
+ * of a node are handled before the node itself.
+ */
+void DependencyGraph::calculatePriorities(const QVector<NodeId> &postOrder)
 {
-    markParentsRecursivlyUnbuildable(m_nodeContainer.value(target));
+    quint64 durationSum = 0;
+    int durationCount = 0;
+    foreach (NodeId id, postOrder) {
+        QHash<QString, quint32>::const_iterator it
+                = m_targetDurations.find(m_nodes.at(id).target->targetName().toLower());
+        if (it != m_targetDurations.constEnd()) {
+            durationSum += it.value();
+            ++durationCount;
+        }
+    }
+    const quint32 defaultWeight = durationCount ? qMax<quint64>(1, durationSum / durationCount) : 1;
+
+    for (int i = postOrder.count(); --i >= 0;) {
+        Node &node = m_nodes[postOrder.at(i)];
+        quint64 parentPriority = 0;
+        const quint32 endParent = node.firstParent + node.parentCount;
+        for (quint32 j = node.firstParent; j < endParent; ++j)
+            parentPriority = qMax(parentPriority, m_nodes.at(m_parentIds.at(j)).priority);
+        node.priority = parentPriority + targetWeight(node.target, defaultWeight);
+    }
 }
 
-bool DependencyGraph::isUnbuildable(DescriptionBlock *target) const
+/**
+ * Removes all up-to-date subgraphs before the first target is executed.
+ *
+ * The time stamps of all targets, dependents and inference rule candidates in the graph
+ * are retrieved concurrently up front. With /CONTENTHASH the dependents that changed
+ * since they were last hashed are hashed concurrently, too. Then the leaves are checked
+ * and up-to-date nodes are removed bottom-up until only nodes remain that must be built.
+ */
+void DependencyGraph::pruneUpToDateSubgraphs(bool ignoreTimeStamps)
 {
-    return m_nodeContainer.value(target)->state == Node::Unbuildable;
+    if (!ignoreTimeStamps) {
+        QSet<QString> dependentNames;
+        dependentNames.reserve(m_nodes.count() * 2);
+        foreach (const Node &node, m_nodes) {
+            foreach (const QString &dependentName, node.target->m_dependents)
+                dependentNames.insert(dependentName);
+            foreach (InferenceRule *rule, node.target->m_inferenceRules)
+                dependentNames.insert(rule->inferredDependent(node.target->targetName()));
+        }
+        const QStringList dependentFileNames = dependentNames.toList();
+        QStringList fileNames = dependentFileNames;
+        foreach (const Node &node, m_nodes)
+            fileNames.append(node.target->targetName());
+        FastFileInfo::statFiles(fileNames);
+        if (m_contentHashes)
+            m_contentHashes->prefetch(dependentFileNames);
+    }
+    processNewLeaves(ignoreTimeStamps);
 }
 
-void DependencyGraph::markParentsRecursivlyUnbuildable(Node *node)
+/**
+ * Marks all ancestors of the target as unbuildable and returns the number of newly
+ * marked nodes.
+ *
+ * The ancestors of an unbuildable node are unbuildable already. Therefore the
+ * propagation stops at unbuildable nodes and visits each ancestor only once.
+ */
+int DependencyGraph::markParentsRecursivlyUnbuildable(DescriptionBlock *target)
 {
-    foreach (Node *parent, node->parents) {
-        parent->state = Node::Unbuildable;
-        markParentsRecursivlyUnbuildable(parent);
+    const NodeId id = nodeId(target);
+    if (id == InvalidNodeId)
+        return 0;
+
+    int count = 0;
+    QVector<NodeId> stack;
+    stack.append(id);
+    while (!stack.isEmpty()) {
+        const Node &node = m_nodes.at(stack.takeLast());
+        const quint32 endParent = node.firstParent + node.parentCount;
+        for (quint32 i = node.firstParent; i < endParent; ++i) {
+            const NodeId parentId = m_parentIds.at(i);
+            Node &parent = m_nodes[parentId];
+            if (parent.state == Node::Unbuildable)
+                continue;
+            parent.state = Node::Unbuildable;
+            ++count;
+            stack.append(parentId);
+        }
     }
+    return count;
+}
+
+/**
+ * Returns the targets that have been discarded since the last call
+ * because they cannot be built due to failed dependencies.
+ * Targets without commands and without a matching inference rule are not included,
+ * but they are counted in discardedCount together with the returned targets.
+ */
+QList<DescriptionBlock*> DependencyGraph::takeBlockedTargets(int *discardedCount)
+{
+    *discardedCount = m_discardedUnbuildableCount;
+    m_discardedUnbuildableCount = 0;
+    QList<DescriptionBlock*> result;
+    result.swap(m_blockedTargets);
+    return result;
 }
 
 bool DependencyGraph::isTargetUpToDate(DescriptionBlock* target)
 {
     FastFileInfo fi(target->targetName());
+    FileTime targetTime;    // compared with the dependents
     if (fi.exists()) {
         target->m_bFileExists = true;
         target->m_timeStamp = fi.lastModified();
+        targetTime = target->m_timeStamp;
+        const BuildLog::Entry *entry = m_buildLog ? m_buildLog->entry(target->targetName()) : 0;
+        if (entry && FileTime(entry->outputTime) == target->m_timeStamp) {
+            // A .RESTAT check found the file unchanged and it wasn't modified since.
+            target->m_timeStamp = FileTime(entry->effectiveTime);
+            targetTime = FileTime(entry->checkTime);
+        }
     }
 
     bool isUpToDate;
@@ -114,9 +290,10 @@ bool DependencyGraph::isTargetUpToDate(DescriptionBlock* target)
     } else {
         // find latest timestamp of all dependents
         FileTime latestDependentTime;
-        foreach (const QString& dependentName, target->m_dependents) {
+        const QVector<DescriptionBlock*> &dependentTargets = target->dependentTargets();
+        for (int i = 0; i < dependentTargets.count(); ++i) {
             FileTime ts;
-            DescriptionBlock *dependent = target->makefile()->target(dependentName);
+            DescriptionBlock *dependent = dependentTargets.at(i);
             if (dependent) {
                 ts = dependent->m_timeStamp;
                 if (!dependent->m_bFileExists && !dependent->m_commands.isEmpty()) {
@@ -128,7 +305,7 @@ bool DependencyGraph::isTargetUpToDate(DescriptionBlock* target)
             }
 
             if (!ts.isValid()) {
-                FastFileInfo fi(dependentName);
+                FastFileInfo fi(target->m_dependents.at(i));
                 if (fi.exists())
                     ts = fi.lastModified();
             }
@@ -146,11 +323,29 @@ bool DependencyGraph::isTargetUpToDate(DescriptionBlock* target)
         if (!target->m_bFileExists)
             target->m_timeStamp = latestDependentTime;
 
-        isUpToDate = (target->m_bFileExists && latestDependentTime <= target->m_timeStamp);
+        if (target->makefile()->options()->buildIfTimeStampsAreEqual)
+            isUpToDate = (target->m_bFileExists && latestDependentTime < targetTime);
+        else
+            isUpToDate = (target->m_bFileExists && latestDependentTime <= targetTime);
+
+        // With inference rules, the content hashes are compared and recorded in the
+        // recursive call below, which takes the inferred dependents into account.
+        if (m_contentHashes && target->m_bFileExists && target->m_inferenceRules.isEmpty()) {
+            if (!isUpToDate) {
+                // The dependents are newer. Maybe they were touched but not changed.
+                isUpToDate = m_contentHashes->isTargetUnchanged(target);
+            } else if (!m_contentHashes->hasTargetRecord(target)) {
+                // Remember the contents, so that touching the dependents later on
+                // doesn't cause a rebuild.
+                m_contentHashes->recordTarget(target);
+            }
+        }
     }
 
-    if (isUpToDate && !target->m_inferenceRules.isEmpty()) {
-        // The target is up-to-date but it still has unapplied inference rules.
+    const bool compareContentHashes = m_contentHashes && target->m_bFileExists;
+    if ((isUpToDate || compareContentHashes) && !target->m_inferenceRules.isEmpty()) {
+        // The target is up-to-date, or its content hashes must be compared, but it still
+        // has unapplied inference rules.
         // That means there could be dependents we didn't take into account yet.
 
         QStringList savedDependents = target->m_dependents;
@@ -166,10 +361,11 @@ bool DependencyGraph::isTargetUpToDate(DescriptionBlock* target)
             }
         }
 
-        if (inferredDependentAdded)
+        if (inferredDependentAdded || compareContentHashes)
             isUpToDate = isTargetUpToDate(target);
 
         target->m_dependents = savedDependents;
+        target->invalidateDependentTargets();
         target->m_inferenceRules = savedRules;
     }
 
@@ -179,21 +375,66 @@ bool DependencyGraph::isTargetUpToDate(DescriptionBlock* target)
     return isUpToDate;
 }
 
-void DependencyGraph::internalBuild(Node *node, QSet<Node *> &seen)
+/**
+ * Computes the hash of the target's commands, unless it is already known.
+ */
+void DependencyGraph::updateCommandHash(DescriptionBlock* target)
 {
-    const int c = seen.count();
-    seen << node;
-    if (c == seen.count())
+    if (target->m_commandHash)
+        return;
+    if (target->m_commands.isEmpty() && target->m_inferenceRules.isEmpty())
         return;
+    target->m_commandHash = target->makefile()->commandHash(target);
+}
 
-    foreach (const QString& dependentName, node->target->m_dependents) {
-        Makefile* const makefile = node->target->makefile();
-        DescriptionBlock* dependent = makefile->target(dependentName);
-        if (!dependent) {
-            // We don't know dependent "foo" but it may have been defined as "C:\MySourceDir\foo"
-            dependent = makefile->target(makefile->dirPath() + QDir::separator() + dependentName);
-        }
+/**
+ * Returns true if the commands of the up-to-date target differ from the commands
+ * that were executed when the target was last built successfully.
+ *
+ * Targets without a log record get one, so that changes are detected from now on.
+ * These records are collected in m_newLogEntries and written by processNewLeaves.
+ */
+bool DependencyGraph::haveCommandsChanged(DescriptionBlock* target)
+{
+    updateCommandHash(target);
+    if (!target->m_commandHash)
+        return false;
+
+    const BuildLog::Entry *entry = m_buildLog->entry(target->targetName());
+    if (!entry) {
+        BuildLog::Entry newEntry;
+        newEntry.commandHash = target->m_commandHash;
+        m_newLogEntries.append(qMakePair(target->targetName(), newEntry));
+        return false;
+    }
+
+    if (entry->exitCode != 0 || entry->commandHash == target->m_commandHash)
+        return false;
+
+    if (!target->makefile()->options()->suppressOutputMessages) {
+        printf("jom: Rebuilding %s because its commands changed.\n",
+               qPrintable(target->targetName()));
+        fflush(stdout);
+    }
+    return true;
+}
+
+/**
+ * Adds the dependents of the node to the graph as its children.
+ *
+ * The children of a node are stored contiguously in m_childIds. Duplicate dependents
+ * are detected in constant time by remembering the last parent of each node.
+ */
+void DependencyGraph::expandNode(NodeId id)
+{
+    m_nodes[id].expanded = true;
+    DescriptionBlock *target = m_nodes.at(id).target;
+    const quint32 firstChild = m_childIds.count();
+    const QVector<DescriptionBlock*> &dependentTargets = target->dependentTargets();
+    for (int i = 0; i < dependentTargets.count(); ++i) {
+        DescriptionBlock* dependent = dependentTargets.at(i);
         if (!dependent) {
+            const QString &dependentName = target->m_dependents.at(i);
             if (!FastFileInfo(dependentName).exists()) {
                 QByteArray msg = "Error: dependent '";
                 msg += dependentName.toLocal8Bit();
@@ -204,32 +445,100 @@ void DependencyGraph::internalBuild(Node *node, QSet<Node *> &seen)
             continue;
         }
 
-        Node* child = m_nodeContainer.value(dependent);
-        if (child)
-            addEdge(node, child);
-        else
-            child = createNode(dependent, node);
+        NodeId childId = nodeId(dependent);
+        if (childId == InvalidNodeId)
+            childId = createNode(dependent);
+        else if (m_nodes.at(childId).lastParent == id)
+            continue;
+        m_nodes[childId].lastParent = id;
+        m_childIds.append(childId);
+    }
+
+    Node &node = m_nodes[id];
+    node.firstChild = firstChild;
+    node.childCount = m_childIds.count() - firstChild;
+    node.pendingChildren = node.childCount;
+}
 
-        internalBuild(child, seen);
+/**
+ * Adds all nodes reachable from root to the graph.
+ *
+ * This is an iterative depth-first search that expands each node once. Nodes are
+ * appended to postOrder when all of their children are finished. The parent edges
+ * are collected in m_edges and are turned into m_parentIds by buildParentEdges.
+ */
+void DependencyGraph::internalBuild(NodeId root, QVector<NodeId> &postOrder)
+{
+    struct Frame
+    {
+        NodeId id;
+        quint32 nextChild;
+    };
+
+    QVector<Frame> stack;
+    expandNode(root);
+    Frame rootFrame = { root, m_nodes.at(root).firstChild };
+    stack.append(rootFrame);
+    while (!stack.isEmpty()) {
+        Frame &frame = stack.last();
+        const Node &node = m_nodes.at(frame.id);
+        if (frame.nextChild == node.firstChild + node.childCount) {
+            postOrder.append(frame.id);
+            if (node.childCount == 0)
+                m_newLeaves.append(frame.id);
+            stack.removeLast();
+            continue;
+        }
+
+        const NodeId childId = m_childIds.at(frame.nextChild++);
+        const Edge edge = { frame.id, childId };
+        m_edges.append(edge);
+        ++m_nodes[childId].parentCount;
+        if (!m_nodes.at(childId).expanded) {
+            expandNode(childId);
+            Frame childFrame = { childId, m_nodes.at(childId).firstChild };
+            stack.append(childFrame);
+        }
     }
+}
 
-    if (node->children.isEmpty())
-        m_leaves.append(node);
+/**
+ * Fills m_parentIds from the collected edges.
+ * The parents of each node keep the order in which their edges were found.
+ */
+void DependencyGraph::buildParentEdges()
+{
+    quint32 offset = 0;
+    for (int i = 0; i < m_nodes.count(); ++i) {
+        Node &node = m_nodes[i];
+        node.firstParent = offset;
+        offset += node.parentCount;
+        node.parentCount = 0;
+    }
+
+    m_parentIds.resize(m_edges.count());
+    foreach (const Edge &edge, m_edges) {
+        Node &child = m_nodes[edge.child];
+        m_parentIds[child.firstParent + child.parentCount++] = edge.parent;
+    }
+    m_edges.clear();
+    m_edges.squeeze();
 }
 
 void DependencyGraph::dump()
 {
     QString indent;
-    internalDump(m_root, indent);
+    foreach (NodeId root, m_roots)
+        internalDump(root, indent);
 }
 
-void DependencyGraph::internalDump(Node* node, QString& indent)
+void DependencyGraph::internalDump(NodeId id, QString& indent)
 {
-    puts(qPrintable(QString(indent + node->target->targetName())));
+    const Node &node = m_nodes.at(id);
+    puts(qPrintable(QString(indent + node.target->targetName())));
     indent.append(QLatin1Char(' '));
-    foreach (Node* child, node->children) {
-        internalDump(child, indent);
-    }
+    for (quint32 i = 0; i < node.childCount; ++i)
+        internalDump(m_childIds.at(node.firstChild + i), indent);
     indent.resize(indent.length() - 1);
 }
 
@@ -237,120 +546,225 @@ void DependencyGraph::dotDump()
 {
     printf("digraph G {\n");
     QString parent;
-    internalDotDump(m_root, parent);
+    foreach (NodeId root, m_roots)
+        internalDotDump(root, parent);
     printf("}\n");
 }
 
-void DependencyGraph::internalDotDump(Node* node, const QString& parent)
+void DependencyGraph::internalDotDump(NodeId id, const QString& parent)
 {
+    const Node &node = m_nodes.at(id);
     if (!parent.isNull()) {
-        QByteArray line = "  \"" + parent.toLocal8Bit() + "\" -> \"" + node->target->targetName().toLocal8Bit() + "\";";
+        QByteArray line = "  \"" + parent.toLocal8Bit() + "\" -> \"" + node.target->targetName().toLocal8Bit() + "\";";
         puts(line);
     }
-    foreach (Node* child, node->children) {
-        internalDotDump(child, node->target->targetName());
-    }
+    for (quint32 i = 0; i < node.childCount; ++i)
+        internalDotDump(m_childIds.at(node.firstChild + i), node.target->targetName());
 }
 
 void DependencyGraph::clear()
 {
-    m_root = 0;
-    qDeleteAll(m_nodeContainer);
-    m_nodeContainer.clear();
-    m_leaves.clear();
-}
-
-void DependencyGraph::addEdge(Node* parent, Node* child)
-{
-    if (!parent->children.contains(child))
-        parent->children.append(child);
-    if (!child->parents.contains(parent))
-        child->parents.append(parent);
+    m_nodes.clear();
+    m_childIds.clear();
+    m_parentIds.clear();
+    m_edges.clear();
+    m_nodeCount = 0;
+    m_roots.clear();
+    m_newLeaves.clear();
+    m_readyQueue.clear();
+    m_readyHeap.clear();
+    m_batchModeLeaves.clear();
+    m_blockedTargets.clear();
+    m_discardedUnbuildableCount = 0;
+    m_readySequenceNumber = 0;
 }
 
 bool DependencyGraph::isEmpty() const
 {
-    return m_nodeContainer.isEmpty();
+    return m_nodeCount == 0;
 }
 
 void DependencyGraph::removeLeaf(DescriptionBlock* target)
 {
-    Node* nodeToRemove = m_nodeContainer.value(target);
-    if (nodeToRemove)
-        removeLeaf(nodeToRemove);
+    const NodeId id = nodeId(target);
+    if (id != InvalidNodeId && m_nodes.at(id).state != Node::Removed)
+        removeLeaf(id);
 }
 
-void DependencyGraph::removeLeaf(Node* node)
+/**
+ * Removes a node without children from the graph.
+ * Parents that lose their last child become new leaves.
+ */
+void DependencyGraph::removeLeaf(NodeId id)
 {
-    Q_ASSERT(node);
-    Q_ASSERT(node->children.isEmpty());
-
-    m_leaves.removeAll(node);
-
-    foreach (Node* parent, node->parents) {
-        parent->children.removeOne(node);
-        if (parent->children.isEmpty()) {
-            m_bDirtyLeaves = true;
-            m_leaves.append(parent);
-        }
+    const Node &node = m_nodes.at(id);
+    Q_ASSERT(node.state != Node::Removed);
+    Q_ASSERT(node.pendingChildren == 0);
+
+    const quint32 endParent = node.firstParent + node.parentCount;
+    for (quint32 i = node.firstParent; i < endParent; ++i) {
+        const NodeId parentId = m_parentIds.at(i);
+        Node &parent = m_nodes[parentId];
+        Q_ASSERT(parent.pendingChildren > 0);
+        if (--parent.pendingChildren == 0)
+            m_newLeaves.append(parentId);
     }
-    deleteNode(node);
+    deleteNode(id);
 }
 
-DescriptionBlock *DependencyGraph::findAvailableTarget(bool ignoreTimeStamps)
+/**
+ * Moves the leaves that appeared since the last call into the ready queue.
+ *
+ * Every new leaf is checked exactly once for being up-to-date. Up-to-date leaves are
+ * removed right away, which may turn their parents into new leaves that are checked
+ * in the same pass. Leaves with failed dependencies are removed the same way.
+ * Inference rules are applied to the leaves that enter the ready queue.
+ * Leaves with a batch mode rule wait in m_batchModeLeaves until applyBatchModeRules is called.
+ */
+void DependencyGraph::processNewLeaves(bool ignoreTimeStamps)
 {
-    if (m_leaves.isEmpty())
-        return 0;
+    if (m_newLeaves.isEmpty())
+        return;
 
-    if (!ignoreTimeStamps) {
-        // remove all leaves that are not up-to-date
-        QList<Node *> upToDateNodes;
-        while (m_bDirtyLeaves) {
-            m_bDirtyLeaves = false;
-            foreach (Node *leaf, m_leaves)
-                if (leaf->state != Node::ExecutingState && isTargetUpToDate(leaf->target))
-                    upToDateNodes.append(leaf);
-            foreach (Node *leaf, upToDateNodes) {
+    QVector<NodeId> readyLeaves;
+    QHash<Makefile*, QList<DescriptionBlock*> > inferenceRuleTargets;
+    for (int i = 0; i < m_newLeaves.count(); ++i) {
+        const NodeId leaf = m_newLeaves.at(i);
+        DescriptionBlock *target = m_nodes.at(leaf).target;
+        if (m_nodes.at(leaf).state == Node::Unbuildable) {
+            // Discard targets with failed dependencies without looking at them.
+            if (!target->m_commands.isEmpty()
+                || (!target->m_inferenceRules.isEmpty()
+                    && target->makefile()->findMatchingInferenceRule(target)))
+            {
+                m_blockedTargets.append(target);
+            }
+            ++m_discardedUnbuildableCount;
+            removeLeaf(leaf);
+            continue;
+        }
+        if (!ignoreTimeStamps && isTargetUpToDate(target)) {
+            if (!m_buildLog || !haveCommandsChanged(target)) {
                 displayNodeBuildInfo(leaf, true);
                 removeLeaf(leaf);
+                continue;
             }
-            upToDateNodes.clear();
+            // The parents must see the new time stamp of the rebuilt target.
+            target->m_timeStamp.clear();
         }
+
+        // Batch mode rules merge the commands of several targets.
+        // Every target is logged with the hash of its own commands.
+        if (m_buildLog)
+            updateCommandHash(target);
+        readyLeaves.append(leaf);
+        if (!target->m_inferenceRules.isEmpty())
+            inferenceRuleTargets[target->makefile()].append(target);
+    }
+    m_newLeaves.clear();
+
+    if (!m_newLogEntries.isEmpty()) {
+        m_buildLog->append(m_newLogEntries);
+        m_newLogEntries.clear();
     }
 
     // apply inference rules separated by makefiles
-    QSet<Makefile*> makefileSet;
-    QMultiHash<Makefile*, DescriptionBlock*> multiHash;
-    foreach (Node *leaf, m_leaves) {
-        makefileSet.insert(leaf->target->makefile());
-        multiHash.insert(leaf->target->makefile(), leaf->target);
+    QSet<DescriptionBlock *> batchModeTargets;
+    QHash<Makefile*, QList<DescriptionBlock*> >::const_iterator it = inferenceRuleTargets.constBegin();
+    for (; it != inferenceRuleTargets.constEnd(); ++it) {
+        foreach (DescriptionBlock *target, it.key()->applyInferenceRules(it.value()))
+            batchModeTargets.insert(target);
     }
-    foreach (Makefile *mf, makefileSet)
-        mf->applyInferenceRules(multiHash.values(mf));
-
-    // return the first leaf that is not currently executed
-    foreach (Node *leaf, m_leaves) {
-        if (leaf->state != Node::ExecutingState) {
-            if (leaf->state != Node::Unbuildable)
-                leaf->state = Node::ExecutingState;
-            displayNodeBuildInfo(leaf, ignoreTimeStamps ? isTargetUpToDate(leaf->target) : false);
-            return leaf->target;
+
+    foreach (NodeId leaf, readyLeaves) {
+        if (batchModeTargets.contains(m_nodes.at(leaf).target)) {
+            if (m_batchModeLeaves.isEmpty())
+                m_batchModeTimer.start();
+            m_batchModeLeaves.append(leaf);
+        } else {
+            enqueueReadyLeaf(leaf);
         }
     }
+}
+
+/**
+ * Returns the time in milliseconds the oldest leaf in m_batchModeLeaves has been waiting.
+ */
+qint64 DependencyGraph::batchModeWaitingTime() const
+{
+    return m_batchModeLeaves.isEmpty() ? 0 : m_batchModeTimer.elapsed();
+}
+
+/**
+ * Forms the batches for all leaves that wait for a batch mode rule and moves them
+ * into the ready queue.
+ */
+void DependencyGraph::applyBatchModeRules(int numberOfBatches)
+{
+    QSet<Makefile *> makefiles;
+    foreach (NodeId leaf, m_batchModeLeaves)
+        makefiles.insert(m_nodes.at(leaf).target->makefile());
+    foreach (Makefile *makefile, makefiles)
+        makefile->applyBatchModeRules(numberOfBatches, m_targetDurations);
+    foreach (NodeId leaf, m_batchModeLeaves)
+        enqueueReadyLeaf(leaf);
+    m_batchModeLeaves.clear();
+}
+
+void DependencyGraph::enqueueReadyLeaf(NodeId id)
+{
+    if (m_criticalPathScheduling) {
+        m_nodes[id].readySequenceNumber = m_readySequenceNumber++;
+        m_readyHeap.append(id);
+        std::push_heap(m_readyHeap.begin(), m_readyHeap.end(), PriorityLessThan(m_nodes));
+    } else {
+        m_readyQueue.enqueue(id);
+    }
+}
+
+DependencyGraph::NodeId DependencyGraph::dequeueReadyLeaf()
+{
+    if (m_criticalPathScheduling) {
+        std::pop_heap(m_readyHeap.begin(), m_readyHeap.end(), PriorityLessThan(m_nodes));
+        const NodeId id = m_readyHeap.last();
+        m_readyHeap.removeLast();
+        return id;
+    }
+    return m_readyQueue.dequeue();
+}
+
+bool DependencyGraph::isReadyQueueEmpty() const
+{
+    return m_readyQueue.isEmpty() && m_readyHeap.isEmpty();
+}
+
+DescriptionBlock *DependencyGraph::findAvailableTarget(bool ignoreTimeStamps)
+{
+    processNewLeaves(ignoreTimeStamps);
+    if (isReadyQueueEmpty())
+        return 0;
 
-    return 0;
+    // Return the leaf with the highest priority. Without critical path scheduling
+    // this is the leaf that has been waiting the longest.
+    const NodeId id = dequeueReadyLeaf();
+    Node &leaf = m_nodes[id];
+    if (leaf.state != Node::Unbuildable)
+        leaf.state = Node::ExecutingState;
+    displayNodeBuildInfo(id, ignoreTimeStamps ? isTargetUpToDate(leaf.target) : false);
+    return leaf.target;
 }
 
-void DependencyGraph::displayNodeBuildInfo(Node* node, bool isUpToDate)
+void DependencyGraph::displayNodeBuildInfo(NodeId id, bool isUpToDate)
 {
-    if (node->target->makefile()->options()->displayBuildInfo) {
+    const DescriptionBlock *target = m_nodes.at(id).target;
+    if (target->makefile()->options()->displayBuildInfo) {
         QByteArray msg;
         if (isUpToDate)
             msg = " ";
         else
             msg = "*";
-        msg += node->target->m_timeStamp.toString().toLocal8Bit() + " " +
-               node->target->targetName().toLocal8Bit();
+        msg += target->m_timeStamp.toString().toLocal8Bit() + " " +
+               target->targetName().toLocal8Bit();
         puts(msg);
     }
 }
@@ -26,11 +26,18 @@
 #ifndef DEPENDENCYGRAPH_H
 #define DEPENDENCYGRAPH_H
 
+#include "buildlog.h"
+
+#include <QtCore/QElapsedTimer>
 #include <QtCore/QHash>
+#include <QtCore/QPair>
+#include <QtCore/QQueue>
 #include <QtCore/QSet>
+#include <QtCore/QVector>
 
 namespace NMakeFile {
 
+class ContentHashes;
 class DescriptionBlock;
 
 class DependencyGraph
@@ -39,44 +46,98 @@ public:
     DependencyGraph();
     ~DependencyGraph();
 
-    void build(DescriptionBlock* target);
-    void markParentsRecursivlyUnbuildable(DescriptionBlock *target);
-    bool isUnbuildable(DescriptionBlock *target) const;
+    void build(const QList<DescriptionBlock*> &targets);
+    void setTargetDurations(const QHash<QString, quint32> &durations);
+    void setContentHashes(ContentHashes *contentHashes) { m_contentHashes = contentHashes; }
+    void setBuildLog(BuildLog *buildLog) { m_buildLog = buildLog; }
+    void pruneUpToDateSubgraphs(bool ignoreTimeStamps);
+    int markParentsRecursivlyUnbuildable(DescriptionBlock *target);
+    QList<DescriptionBlock*> takeBlockedTargets(int *discardedCount);
     bool isEmpty() const;
     void removeLeaf(DescriptionBlock* target);
     DescriptionBlock *findAvailableTarget(bool ignoreTimeStamps);
+    bool hasPendingBatchModeTargets() const { return !m_batchModeLeaves.isEmpty(); }
+    qint64 batchModeWaitingTime() const;
+    void applyBatchModeRules(int numberOfBatches);
     void dump();
     void dotDump();
     void clear();
 
 private:
     bool isTargetUpToDate(DescriptionBlock* target);
+    bool haveCommandsChanged(DescriptionBlock* target);
+    static void updateCommandHash(DescriptionBlock* target);
+
+    typedef quint32 NodeId;
+    static const NodeId InvalidNodeId = 0xffffffffu;
 
+    /**
+     * Nodes live in m_nodes and are referred to by their index.
+     * The edges are stored in the flat arrays m_childIds and m_parentIds.
+     * Removed nodes stay in m_nodes until the graph is cleared.
+     */
     struct Node
     {
-        enum State {UnknownState, ExecutingState, Unbuildable};
+        enum State {UnknownState, ExecutingState, Unbuildable, Removed};
 
-        State state;
         DescriptionBlock* target;
-        QList<Node*> children;
-        QList<Node*> parents;
+        quint64 priority;               // longest weighted path to the root
+        quint32 firstChild;             // index into m_childIds
+        quint32 childCount;
+        quint32 firstParent;            // index into m_parentIds
+        quint32 parentCount;
+        quint32 pendingChildren;        // number of children that are not yet removed
+        quint32 readySequenceNumber;
+        NodeId lastParent;              // used to detect duplicate edges while building
+        quint8 state;
+        bool expanded;                  // dependents have been added to the graph
+    };
+
+    struct Edge
+    {
+        NodeId parent;
+        NodeId child;
     };
 
-    Node* createNode(DescriptionBlock* target, Node* parent);
-    void deleteNode(Node* node);
-    void removeLeaf(Node* node);
-    void internalBuild(Node *node, QSet<Node *> &seen);
-    void addEdge(Node* parent, Node* child);
-    void internalDump(Node* node, QString& indent);
-    void internalDotDump(Node* node, const QString& parent);
-    void displayNodeBuildInfo(Node* node, bool isUpToDate);
-    static void markParentsRecursivlyUnbuildable(Node *node);
+    NodeId nodeId(DescriptionBlock *target) const;
+    NodeId createNode(DescriptionBlock* target);
+    void deleteNode(NodeId id);
+    void removeLeaf(NodeId id);
+    void expandNode(NodeId id);
+    void internalBuild(NodeId root, QVector<NodeId> &postOrder);
+    void buildParentEdges();
+    void calculatePriorities(const QVector<NodeId> &postOrder);
+    quint32 targetWeight(DescriptionBlock *target, quint32 defaultWeight) const;
+    void enqueueReadyLeaf(NodeId id);
+    NodeId dequeueReadyLeaf();
+    bool isReadyQueueEmpty() const;
+    void internalDump(NodeId id, QString& indent);
+    void internalDotDump(NodeId id, const QString& parent);
+    void displayNodeBuildInfo(NodeId id, bool isUpToDate);
+    void processNewLeaves(bool ignoreTimeStamps);
+
+    class PriorityLessThan;
 
 private:
-    Node* m_root;
-    QHash<DescriptionBlock*, Node*> m_nodeContainer;
-    QList<Node *> m_leaves;
-    bool m_bDirtyLeaves;
+    QVector<Node> m_nodes;
+    QVector<NodeId> m_childIds;
+    QVector<NodeId> m_parentIds;
+    QVector<Edge> m_edges;              // all edges in the order they were found while building
+    int m_nodeCount;                    // number of nodes that are not removed
+    QVector<NodeId> m_roots;
+    QVector<NodeId> m_newLeaves;        // leaves that have not been looked at yet
+    QQueue<NodeId> m_readyQueue;        // leaves that are waiting for execution
+    QVector<NodeId> m_readyHeap;        // same as m_readyQueue for critical path scheduling
+    QVector<NodeId> m_batchModeLeaves;  // leaves that wait for their batch to be formed
+    QList<DescriptionBlock*> m_blockedTargets;  // discarded due to failed dependencies
+    int m_discardedUnbuildableCount;    // unbuildable nodes discarded since takeBlockedTargets
+    QElapsedTimer m_batchModeTimer;     // started when the first of m_batchModeLeaves arrived
+    quint32 m_readySequenceNumber;
+    bool m_criticalPathScheduling;
+    QHash<QString, quint32> m_targetDurations;
+    ContentHashes *m_contentHashes;     // 0 unless /CONTENTHASH is given
+    BuildLog *m_buildLog;               // 0 if the executed commands are not logged
+    QVector<QPair<QString, BuildLog::Entry> > m_newLogEntries;  // not yet added to m_buildLog
 };
 
 } // namespace NMakeFile
@@ -23,74 +23,376 @@
 **
 ****************************************************************************/
 
+
 #include "fastfileinfo.h"
+#include "fastfileinfo_p.h"
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QDir>
+#include <QtCore/QMutex>
+#include <QtCore/QRegExp>
+#include <QtCore/QRunnable>
+#include <QtCore/QSet>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QStringList>
+#include <QtCore/QThread>
+#include <QtCore/QThreadPool>
 
-#include <QtCore/QDebug>
-#include <QtCore/QHash>
-#include <windows.h>
+#include <algorithm>
 
 namespace NMakeFile {
 
-template<bool> struct CompileTimeAssert;
-template<> struct CompileTimeAssert<true> {};
-static CompileTimeAssert<
-    sizeof(FastFileInfo::InternalType) == sizeof(WIN32_FILE_ATTRIBUTE_DATA)
-        > internal_type_has_wrong_size;
+/**
+ * A directory whose entries have been read.
+ * Files that are not among the entries do not exist.
+ * Invalidating a directory makes all cached file information that refers to it stale at once.
+ */
+struct Directory
+{
+    Directory() : valid(1) {}
+
+    DirectoryEntries entries;
+    QStringList names;              // entry names as stored in the file system
+    QAtomicInt valid;
+};
+
+typedef QSharedPointer<Directory> DirectoryPtr;
+
+struct CachedFile
+{
+    FileAttributes attributes;
+    DirectoryPtr directory;         // null for files that were stat'ed individually
+};
+
+/**
+ * The cache is split into shards with their own locks, so it can be used from
+ * several threads at once without them contending for a single lock.
+ * Files are assigned to shards by file name as passed to FastFileInfo,
+ * directories by normalized directory path.
+ */
+struct CacheShard
+{
+    CacheShard() : invalidationCount(0) {}
+
+    QMutex mutex;
+    QHash<QString, CachedFile> files;
+    QHash<QString, DirectoryPtr> directories;
+    QSet<QString> writtenDirectories;   // directories that commands changed during this run
+    quint32 invalidationCount;      // incremented whenever an entry of this shard is dropped
+};
+
+static const uint shardCount = 64;
+static CacheShard cacheShards[shardCount];
 
-inline WIN32_FILE_ATTRIBUTE_DATA* z(FastFileInfo::InternalType &internalData)
+static CacheShard &shardFor(const QString &key)
 {
-    return reinterpret_cast<WIN32_FILE_ATTRIBUTE_DATA*>(&internalData);
+    return cacheShards[qHash(key) % shardCount];
 }
 
-inline const WIN32_FILE_ATTRIBUTE_DATA* z(const FastFileInfo::InternalType &internalData)
+static FileAttributes createInvalidAttributes()
 {
-    return reinterpret_cast<const WIN32_FILE_ATTRIBUTE_DATA*>(&internalData);
+    FileAttributes attributes;
+    attributes.lastWriteTime = 0;
+    attributes.size = 0;
+    attributes.exists = false;
+    return attributes;
 }
 
-static WIN32_FILE_ATTRIBUTE_DATA createInvalidFAD()
+/**
+ * Returns the normalized absolute path of a directory that is used as key in the cache.
+ * All spellings of a directory, relative or absolute, map to the same key.
+ */
+static QString directoryKey(const QString &dirPath)
 {
-    WIN32_FILE_ATTRIBUTE_DATA fad = {0};
-    fad.dwFileAttributes = INVALID_FILE_ATTRIBUTES;
-    return fad;
+    QString key = dirPath.isEmpty() ? QStringLiteral(".") : QDir::fromNativeSeparators(dirPath);
+    if (key.endsWith(QLatin1Char(':')))
+        key += QLatin1Char('/');    // "C:" would be the current directory of drive C
+    key = QDir::cleanPath(QDir::current().absoluteFilePath(key));
+    if (fileNameCaseSensitivity == Qt::CaseInsensitive)
+        key = key.toLower();
+    return key;
 }
 
-static QHash<QString, WIN32_FILE_ATTRIBUTE_DATA> fadHash;
+/**
+ * Splits a file name into the normalized path of its directory and the entry name.
+ * Returns false for file names that cannot be looked up in a directory listing.
+ */
+static bool splitFileName(const QString &fileName, QString *dirKey, QString *entryName)
+{
+    if (fileName.isEmpty()
+            || fileName.contains(QLatin1Char('"'))
+            || fileName.contains(QLatin1Char('*'))
+            || fileName.contains(QLatin1Char('?')))
+    {
+        return false;
+    }
+
+    const int idx = qMax(fileName.lastIndexOf(QLatin1Char('/')),
+                         fileName.lastIndexOf(QLatin1Char('\\')));
+    *entryName = fileName.mid(idx + 1);
+    if (entryName->isEmpty()
+            || entryName->contains(QLatin1Char(':'))
+            || *entryName == QLatin1String(".")
+            || *entryName == QLatin1String(".."))
+    {
+        return false;
+    }
+
+    if (idx < 0)
+        *dirKey = directoryKey(QString());
+    else if (idx == 0)
+        *dirKey = directoryKey(QStringLiteral("/"));
+    else
+        *dirKey = directoryKey(fileName.left(idx));
 
-FastFileInfo::FastFileInfo(const QString &fileName)
+    if (fileNameCaseSensitivity == Qt::CaseInsensitive)
+        *entryName = entryName->toLower();
+    return true;
+}
+
+/**
+ * Returns the cached directory, reading it if necessary.
+ * The directory is read without holding the lock. If another thread invalidated a
+ * directory of the same shard meanwhile, the result is returned but not cached,
+ * because it might have been read before the invalidating change.
+ */
+static DirectoryPtr cachedDirectory(const QString &dirKey)
 {
-    static const WIN32_FILE_ATTRIBUTE_DATA invalidFAD = createInvalidFAD();
-    *z(m_attributes) = fadHash.value(fileName, invalidFAD);
-    if (z(m_attributes)->dwFileAttributes != INVALID_FILE_ATTRIBUTES)
-        return;
+    CacheShard &shard = shardFor(dirKey);
+    quint32 invalidationCount;
+    {
+        QMutexLocker locker(&shard.mutex);
+        const DirectoryPtr directory = shard.directories.value(dirKey);
+        if (directory)
+            return directory;
+        invalidationCount = shard.invalidationCount;
+    }
+
+    DirectoryPtr directory(new Directory);
+    readDirectory(dirKey, &directory->entries, &directory->names);
 
-    if (!GetFileAttributesEx(reinterpret_cast<const TCHAR*>(fileName.utf16()),
-                             GetFileExInfoStandard, &m_attributes))
+    QMutexLocker locker(&shard.mutex);
+    if (shard.invalidationCount != invalidationCount) {
+        directory->valid.storeRelease(0);
+        return directory;
+    }
+    const DirectoryPtr existing = shard.directories.value(dirKey);
+    if (existing)
+        return existing;    // another thread was faster
+    shard.directories.insert(dirKey, directory);
+    return directory;
+}
+
+/**
+ * Drops the cached directory and remembers that it has been written.
+ */
+static void removeDirectory(const QString &dirKey)
+{
+    CacheShard &shard = shardFor(dirKey);
+    QMutexLocker locker(&shard.mutex);
+    ++shard.invalidationCount;
+    shard.writtenDirectories.insert(dirKey);
+    const DirectoryPtr directory = shard.directories.take(dirKey);
+    if (directory)
+        directory->valid.storeRelease(0);
+}
+
+static bool isWrittenDirectory(const QString &dirKey)
+{
+    CacheShard &shard = shardFor(dirKey);
+    QMutexLocker locker(&shard.mutex);
+    return shard.writtenDirectories.contains(dirKey);
+}
+
+/**
+ * Looks up the attributes of a file. This function is thread-safe.
+ *
+ * The first lookup in a directory reads the whole directory. All later lookups in that
+ * directory are answered from the cache, including the ones for files that do not exist.
+ * Misses are not final in directories that a command changed during this run. The
+ * command may have written other files than its declared outputs, possibly after the
+ * directory was read again, so such misses are checked with a stat call every time.
+ */
+static FileAttributes lookup(const QString &fileName)
+{
+    CacheShard &fileShard = shardFor(fileName);
+    quint32 invalidationCount;
     {
-        z(m_attributes)->dwFileAttributes = INVALID_FILE_ATTRIBUTES;
-        return;
+        QMutexLocker locker(&fileShard.mutex);
+        QHash<QString, CachedFile>::const_iterator it = fileShard.files.constFind(fileName);
+        if (it != fileShard.files.constEnd()
+                && (!it->directory || it->directory->valid.loadAcquire()))
+        {
+            return it->attributes;
+        }
+        invalidationCount = fileShard.invalidationCount;
+    }
+
+    static const FileAttributes invalidAttributes = createInvalidAttributes();
+    CachedFile cachedFile;
+    cachedFile.attributes = invalidAttributes;
+    QString dirKey, entryName;
+    if (splitFileName(fileName, &dirKey, &entryName)) {
+        cachedFile.directory = cachedDirectory(dirKey);
+        cachedFile.attributes = cachedFile.directory->entries.value(entryName, invalidAttributes);
+        if (!cachedFile.attributes.exists && isWrittenDirectory(dirKey)
+                && !statFile(fileName, &cachedFile.attributes))
+        {
+            return cachedFile.attributes;
+        }
+    } else if (!statFile(fileName, &cachedFile.attributes)) {
+        return cachedFile.attributes;
     }
 
-    fadHash.insert(fileName, *z(m_attributes));
+    QMutexLocker locker(&fileShard.mutex);
+    if (fileShard.invalidationCount == invalidationCount)
+        fileShard.files.insert(fileName, cachedFile);
+    return cachedFile.attributes;
 }
 
-bool FastFileInfo::exists() const
+FastFileInfo::FastFileInfo(const QString &fileName, CacheMode cacheMode)
 {
-    return z(m_attributes)->dwFileAttributes != INVALID_FILE_ATTRIBUTES; 
+    FileAttributes attributes;
+    if (cacheMode == UseCache)
+        attributes = lookup(fileName);
+    else if (!statFile(fileName, &attributes))
+        attributes = createInvalidAttributes();
+    m_exists = attributes.exists;
+    m_size = attributes.size;
+    if (m_exists)
+        m_lastModified = FileTime(attributes.lastWriteTime);
 }
 
 FileTime FastFileInfo::lastModified() const
 {
-    const WIN32_FILE_ATTRIBUTE_DATA *fattr = z(m_attributes);
-    if (fattr->dwFileAttributes == INVALID_FILE_ATTRIBUTES) {
-        return FileTime();
-    } else {
-        return FileTime(reinterpret_cast<const FileTime::InternalType&>(fattr->ftLastWriteTime));
-    }
+    return m_lastModified;
 }
 
+/**
+ * Invalidates the cached information about the file and about all other files
+ * in the same directory. Must be called after a command changed the file.
+ * Files that are missing from the directory are looked up again from now on.
+ * Lookups that run concurrently in other threads see either the old or the new state.
+ */
 void FastFileInfo::clearCacheForFile(const QString &fileName)
 {
-    fadHash.remove(fileName);
+    CacheShard &shard = shardFor(fileName);
+    {
+        QMutexLocker locker(&shard.mutex);
+        ++shard.invalidationCount;
+        shard.files.remove(fileName);
+    }
+    QString dirKey, entryName;
+    if (splitFileName(fileName, &dirKey, &entryName))
+        removeDirectory(dirKey);
+}
+
+namespace {
+
+class ReadDirectoriesTask : public QRunnable
+{
+public:
+    ReadDirectoriesTask(const QStringList &dirKeys, int begin, int end)
+        : m_dirKeys(dirKeys), m_begin(begin), m_end(end)
+    {
+    }
+
+    void run()
+    {
+        for (int i = m_begin; i < m_end; ++i)
+            cachedDirectory(m_dirKeys.at(i));
+    }
+
+private:
+    const QStringList &m_dirKeys;
+    const int m_begin;
+    const int m_end;
+};
+
+} // anonymous namespace
+
+/**
+ * Reads the given directories into the cache unless they are cached already.
+ * The directories are read concurrently, which pays off for large numbers
+ * of directories and for file systems with high latency.
+ */
+static void readDirectoriesConcurrently(const QSet<QString> &dirKeySet)
+{
+    QStringList dirKeys;
+    foreach (const QString &dirKey, dirKeySet) {
+        CacheShard &shard = shardFor(dirKey);
+        QMutexLocker locker(&shard.mutex);
+        if (!shard.directories.contains(dirKey))
+            dirKeys.append(dirKey);
+    }
+
+    const int count = dirKeys.count();
+    if (count < 2)
+        return;     // Not worth the effort. The directories are read on demand.
+
+    QThreadPool threadPool;
+    threadPool.setMaxThreadCount(2 * QThread::idealThreadCount());
+    const int dirsPerTask = qMax(1, count / (4 * threadPool.maxThreadCount()));
+    for (int begin = 0; begin < count; begin += dirsPerTask) {
+        threadPool.start(new ReadDirectoriesTask(dirKeys, begin,
+                                                 qMin(begin + dirsPerTask, count)));
+    }
+    threadPool.waitForDone();
+}
+
+/**
+ * Fills the cache for the given files.
+ */
+void FastFileInfo::statFiles(const QStringList &fileNames)
+{
+    QSet<QString> dirKeySet;
+    QString dirKey, entryName;
+    foreach (const QString &fileName, fileNames) {
+        if (splitFileName(fileName, &dirKey, &entryName))
+            dirKeySet.insert(dirKey);
+    }
+    readDirectoriesConcurrently(dirKeySet);
+}
+
+/**
+ * Fills the cache for the given directories.
+ */
+void FastFileInfo::readDirectories(const QStringList &dirPaths)
+{
+    QSet<QString> dirKeySet;
+    foreach (const QString &dirPath, dirPaths)
+        dirKeySet.insert(directoryKey(dirPath));
+    readDirectoriesConcurrently(dirKeySet);
+}
+
+static bool fileNameLessThan(const QString &lhs, const QString &rhs)
+{
+    return QString::compare(lhs, rhs, Qt::CaseInsensitive) < 0;
+}
+
+/**
+ * Returns the names of the entries of a directory that match the wildcard pattern,
+ * sorted case-insensitively. Entries starting with a dot only match patterns
+ * that start with a dot.
+ *
+ * The directory listing is taken from the cache, so the time stamps of the
+ * matching files are known afterwards.
+ */
+QStringList FastFileInfo::findFiles(const QString &dirPath, const QString &pattern)
+{
+    const DirectoryPtr directory = cachedDirectory(directoryKey(dirPath));
+    // Wildcards match case-insensitively on all platforms, like nmake does.
+    const QRegExp rx(pattern, Qt::CaseInsensitive, QRegExp::Wildcard);
+    const bool matchHiddenFiles = pattern.startsWith(QLatin1Char('.'));
+    QStringList result;
+    foreach (const QString &name, directory->names) {
+        if (!matchHiddenFiles && name.startsWith(QLatin1Char('.')))
+            continue;
+        if (rx.exactMatch(name))
+            result.append(name);
+    }
+    std::sort(result.begin(), result.end(), fileNameLessThan);
+    return result;
 }
 
 } // NMakeFile
@@ -28,25 +28,40 @@
 
 #include "filetime.h"
 
+QT_BEGIN_NAMESPACE
+class QStringList;
+QT_END_NAMESPACE
+
 namespace NMakeFile {
 
+/**
+ * Cached file information. It may be used from any thread.
+ */
 class FastFileInfo
 {
 public:
-    FastFileInfo(const QString &fileName);
+    enum CacheMode
+    {
+        UseCache,
+        BypassCache     // stat the file itself, without reading or filling the cache
+    };
+
+    FastFileInfo() : m_size(0), m_exists(false) {}
+    FastFileInfo(const QString &fileName, CacheMode cacheMode = UseCache);
 
-    bool exists() const;
+    bool exists() const { return m_exists; }
     FileTime lastModified() const;
+    qint64 size() const { return m_size; }
 
     static void clearCacheForFile(const QString &fileName);
-
-    struct InternalType
-    {
-        quint8 z[36];
-    };
+    static void statFiles(const QStringList &fileNames);
+    static void readDirectories(const QStringList &dirPaths);
+    static QStringList findFiles(const QString &dirPath, const QString &pattern);
 
 private:
-    InternalType m_attributes;
+    FileTime m_lastModified;
+    qint64 m_size;
+    bool m_exists;
 };
 
 } // NMakeFile
@@ -0,0 +1,72 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of jom.
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+
+#ifndef FASTFILEINFO_P_H
+#define FASTFILEINFO_P_H
+
+#include "filetime.h"
+
+#include <QtCore/QHash>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+
+namespace NMakeFile {
+
+// Internal interface between the FastFileInfo cache and the platform specific
+// file system access in fastfileinfo_win.cpp and fastfileinfo_unix.cpp.
+
+struct FileAttributes
+{
+    FileTime::InternalType lastWriteTime;
+    qint64 size;
+    bool exists;
+};
+
+typedef QHash<QString, FileAttributes> DirectoryEntries;
+
+#ifdef Q_OS_WIN
+const Qt::CaseSensitivity fileNameCaseSensitivity = Qt::CaseInsensitive;
+#else
+const Qt::CaseSensitivity fileNameCaseSensitivity = Qt::CaseSensitive;
+#endif
+
+/**
+ * Retrieves the attributes of a single file.
+ * Returns false if the file does not exist.
+ */
+bool statFile(const QString &fileName, FileAttributes *attributes);
+
+/**
+ * Retrieves the attributes of all entries of a directory.
+ * On case insensitive file systems the keys of entries are converted to lower case.
+ * names receives the entry names as they are stored in the file system.
+ * Returns false if the directory cannot be read.
+ */
+bool readDirectory(const QString &dirPath, DirectoryEntries *entries, QStringList *names);
+
+} // namespace NMakeFile
+
+#endif // FASTFILEINFO_P_H
@@ -0,0 +1,177 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of jom.
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+
+#include "fastfileinfo_p.h"
+#ifdef JOM_HAVE_IO_URING
+#include "iouring.h"
+#endif
+
+#include <QtCore/QFile>
+#include <QtCore/QThreadStorage>
+#include <QtCore/QVector>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+namespace NMakeFile {
+
+static const quint64 nanosecondsPerSecond = 1000000000;
+
+#if defined(__linux__) && defined(STATX_MTIME)
+static void setAttributes(const struct statx &stx, FileAttributes *attributes)
+{
+    attributes->lastWriteTime = quint64(stx.stx_mtime.tv_sec) * nanosecondsPerSecond
+                                + stx.stx_mtime.tv_nsec;
+    attributes->size = qint64(stx.stx_size);
+    attributes->exists = true;
+}
+#endif
+
+/**
+ * Retrieves the modification time with nanosecond resolution.
+ * A relative path is resolved against the directory dirfd.
+ */
+static bool statFileAt(int dirfd, const char *path, FileAttributes *attributes)
+{
+#if defined(__linux__) && defined(STATX_MTIME)
+    struct statx stx;
+    if (statx(dirfd, path, 0, STATX_MTIME | STATX_SIZE, &stx) != 0) {
+        attributes->exists = false;
+        return false;
+    }
+    setAttributes(stx, attributes);
+#else
+    struct stat st;
+    if (fstatat(dirfd, path, &st, 0) != 0) {
+        attributes->exists = false;
+        return false;
+    }
+#  if defined(__APPLE__)
+    const struct timespec &mtime = st.st_mtimespec;
+#  else
+    const struct timespec &mtime = st.st_mtim;
+#  endif
+    attributes->lastWriteTime = quint64(mtime.tv_sec) * nanosecondsPerSecond + mtime.tv_nsec;
+    attributes->size = qint64(st.st_size);
+    attributes->exists = true;
+#endif
+    return true;
+}
+
+bool statFile(const QString &fileName, FileAttributes *attributes)
+{
+    return statFileAt(AT_FDCWD, QFile::encodeName(fileName).constData(), attributes);
+}
+
+#ifdef JOM_HAVE_IO_URING
+/**
+ * Returns the io_uring instance of the calling thread.
+ * It is set up on first use and reused for all directories read by the thread.
+ * If io_uring is not available, the instance stays invalid.
+ */
+static IoUring *threadRing()
+{
+    static QThreadStorage<IoUring *> rings;
+    if (!rings.hasLocalData())
+        rings.setLocalData(new IoUring);
+    return rings.localData();
+}
+
+/**
+ * Stats the directory entries through io_uring, which lets the kernel work on
+ * all of them at once instead of one blocking statx per entry.
+ * Entries that failed for another reason than having been deleted meanwhile are
+ * stat'ed again synchronously, so that their errors are handled like in readDirectory.
+ * Returns false if io_uring cannot be used.
+ */
+static bool statEntriesWithIoUring(int fd, const QVector<QByteArray> &names,
+                                   const QStringList &decodedNames, DirectoryEntries *entries)
+{
+    // Waiting for the completions doesn't pay off for small directories.
+    const int minimumBatchSize = 16;
+    if (names.count() < minimumBatchSize)
+        return false;
+
+    IoUring *ring = threadRing();
+    if (!ring->isValid())
+        return false;
+
+    QVector<const char *> paths(names.count());
+    for (int i = 0; i < names.count(); ++i)
+        paths[i] = names.at(i).constData();
+    QVector<struct statx> buffers(names.count());
+    QVector<int> results(names.count());
+    if (!ring->statx(fd, paths.constData(), paths.count(), STATX_MTIME | STATX_SIZE,
+                    buffers.data(), results.data())) {
+        return false;
+    }
+
+    for (int i = 0; i < names.count(); ++i) {
+        FileAttributes attributes;
+        if (results.at(i) == 0)
+            setAttributes(buffers.at(i), &attributes);
+        else if (results.at(i) == -ENOENT || !statFileAt(fd, names.at(i).constData(), &attributes))
+            continue;
+        entries->insert(decodedNames.at(i), attributes);
+    }
+    return true;
+}
+#endif
+
+bool readDirectory(const QString &dirPath, DirectoryEntries *entries, QStringList *decodedNames)
+{
+    DIR *dir = opendir(QFile::encodeName(dirPath).constData());
+    if (!dir)
+        return false;
+
+    const int fd = dirfd(dir);
+    QVector<QByteArray> names;
+    while (const struct dirent *entry = readdir(dir)) {
+        const char *name = entry->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+            continue;
+        names.append(QByteArray(name));
+        decodedNames->append(QFile::decodeName(name));
+    }
+
+#ifdef JOM_HAVE_IO_URING
+    if (!statEntriesWithIoUring(fd, names, *decodedNames, entries))
+#endif
+    {
+        for (int i = 0; i < names.count(); ++i) {
+            FileAttributes attributes;
+            if (statFileAt(fd, names.at(i).constData(), &attributes))
+                entries->insert(decodedNames->at(i), attributes);
+        }
+    }
+
+    closedir(dir);
+    return true;
+}
+
+} // NMakeFile
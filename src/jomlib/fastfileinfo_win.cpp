@@ -0,0 +1,85 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of jom.
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+
+#include "fastfileinfo_p.h"
+
+#include <QtCore/QDir>
+#include <windows.h>
+
+namespace NMakeFile {
+
+template<bool> struct CompileTimeAssert;
+template<> struct CompileTimeAssert<true> {};
+static CompileTimeAssert<sizeof(FileTime::InternalType) == sizeof(FILETIME)> internal_type_has_wrong_size;
+
+static FileTime::InternalType fromFileTime(const FILETIME &ft)
+{
+    return *reinterpret_cast<const FileTime::InternalType *>(&ft);
+}
+
+bool statFile(const QString &fileName, FileAttributes *attributes)
+{
+    WIN32_FILE_ATTRIBUTE_DATA fad;
+    if (!GetFileAttributesEx(reinterpret_cast<const TCHAR*>(fileName.utf16()),
+                             GetFileExInfoStandard, &fad))
+    {
+        attributes->exists = false;
+        return false;
+    }
+
+    attributes->lastWriteTime = fromFileTime(fad.ftLastWriteTime);
+    attributes->size = (qint64(fad.nFileSizeHigh) << 32) | fad.nFileSizeLow;
+    attributes->exists = true;
+    return true;
+}
+
+bool readDirectory(const QString &dirPath, DirectoryEntries *entries, QStringList *names)
+{
+    const QString pattern = QDir::toNativeSeparators(dirPath) + QLatin1String("\\*");
+    WIN32_FIND_DATA fd;
+    HANDLE hFind = FindFirstFileEx(reinterpret_cast<const TCHAR*>(pattern.utf16()),
+                                   FindExInfoBasic, &fd, FindExSearchNameMatch,
+                                   NULL, FIND_FIRST_EX_LARGE_FETCH);
+    if (hFind == INVALID_HANDLE_VALUE)
+        return false;
+
+    do {
+        const QString name = QString::fromWCharArray(fd.cFileName);
+        if (name == QLatin1String(".") || name == QLatin1String(".."))
+            continue;
+        FileAttributes attributes;
+        attributes.lastWriteTime = fromFileTime(fd.ftLastWriteTime);
+        attributes.size = (qint64(fd.nFileSizeHigh) << 32) | fd.nFileSizeLow;
+        attributes.exists = true;
+        entries->insert(name.toLower(), attributes);
+        names->append(name);
+    } while (FindNextFile(hFind, &fd));
+
+    FindClose(hFind);
+    return true;
+}
+
+} // NMakeFile
@@ -0,0 +1,78 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of jom.
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+
+#include "filetime.h"
+
+#include <time.h>
+
+namespace NMakeFile {
+
+// The internal representation is the number of nanoseconds since the epoch.
+
+static const quint64 nanosecondsPerSecond = 1000000000;
+
+FileTime::FileTime()
+    : m_fileTime(0)
+{
+}
+
+bool FileTime::operator < (const FileTime &rhs) const
+{
+    return m_fileTime < rhs.m_fileTime;
+}
+
+void FileTime::clear()
+{
+    m_fileTime = 0;
+}
+
+bool FileTime::isValid() const
+{
+    return m_fileTime != 0;
+}
+
+FileTime FileTime::currentTime()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return FileTime(quint64(ts.tv_sec) * nanosecondsPerSecond + quint64(ts.tv_nsec));
+}
+
+QString FileTime::toString() const
+{
+    const time_t t = time_t(m_fileTime / nanosecondsPerSecond);
+    struct tm local;
+    if (!localtime_r(&t, &local))
+        return QString();
+
+    char str[64];
+    snprintf(str, sizeof(str), "%02d.%02d.%d %02d:%02d:%02d",
+             local.tm_mday, local.tm_mon + 1, local.tm_year + 1900,
+             local.tm_hour, local.tm_min, local.tm_sec);
+    return QString::fromLatin1(str);
+}
+
+} // namespace NMakeFile
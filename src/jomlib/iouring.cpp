@@ -0,0 +1,213 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of jom.
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+
+#include "iouring.h"
+
+#include <QtCore/QByteArray>
+
+#include <linux/io_uring.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace NMakeFile {
+
+static int ioUringSetup(unsigned int entries, struct io_uring_params *params)
+{
+    return int(syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int ioUringEnter(int fd, unsigned int toSubmit, unsigned int minComplete, unsigned int flags)
+{
+    return int(syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, 0, 0));
+}
+
+static int ioUringRegister(int fd, unsigned int opcode, void *arg, unsigned int argCount)
+{
+    return int(syscall(__NR_io_uring_register, fd, opcode, arg, argCount));
+}
+
+/**
+ * Asks the kernel whether the io_uring instance supports the operation.
+ * Kernels before 5.6 support neither the probe nor IORING_OP_STATX.
+ */
+static bool isOperationSupported(int fd, unsigned int opcode)
+{
+    const unsigned int opCount = 256;
+    QByteArray buffer(int(sizeof(struct io_uring_probe)
+                          + opCount * sizeof(struct io_uring_probe_op)), '\0');
+    struct io_uring_probe *probe = reinterpret_cast<struct io_uring_probe *>(buffer.data());
+    if (ioUringRegister(fd, IORING_REGISTER_PROBE, probe, opCount) < 0)
+        return false;
+    return opcode <= probe->last_op && (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED);
+}
+
+template <typename T>
+static T *ringPointer(void *ring, quint32 offset)
+{
+    return reinterpret_cast<T *>(static_cast<char *>(ring) + offset);
+}
+
+IoUring::IoUring(unsigned int entries)
+    : m_fd(-1)
+    , m_entries(0)
+    , m_sqRing(MAP_FAILED)
+    , m_cqRing(MAP_FAILED)
+    , m_sqRingSize(0)
+    , m_cqRingSize(0)
+    , m_sqes(MAP_FAILED)
+    , m_sqesSize(0)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    const int fd = ioUringSetup(entries, &params);
+    if (fd < 0)
+        return;     // Kernel too old or io_uring disabled. The caller falls back to statx.
+    if (!isOperationSupported(fd, IORING_OP_STATX)) {
+        close(fd);
+        return;
+    }
+
+    m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    const bool singleMapping = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (singleMapping)
+        m_sqRingSize = m_cqRingSize = qMax(m_sqRingSize, m_cqRingSize);
+
+    m_fd = fd;
+    m_sqRing = mmap(0, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    fd, IORING_OFF_SQ_RING);
+    if (singleMapping)
+        m_cqRing = m_sqRing;
+    else
+        m_cqRing = mmap(0, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        fd, IORING_OFF_CQ_RING);
+    m_sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    m_sqes = mmap(0, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  fd, IORING_OFF_SQES);
+    if (m_sqRing == MAP_FAILED || m_cqRing == MAP_FAILED || m_sqes == MAP_FAILED) {
+        release();
+        return;
+    }
+
+    m_sqHead = ringPointer<unsigned int>(m_sqRing, params.sq_off.head);
+    m_sqTail = ringPointer<unsigned int>(m_sqRing, params.sq_off.tail);
+    m_sqMask = ringPointer<unsigned int>(m_sqRing, params.sq_off.ring_mask);
+    m_sqArray = ringPointer<unsigned int>(m_sqRing, params.sq_off.array);
+    m_cqHead = ringPointer<unsigned int>(m_cqRing, params.cq_off.head);
+    m_cqTail = ringPointer<unsigned int>(m_cqRing, params.cq_off.tail);
+    m_cqMask = ringPointer<unsigned int>(m_cqRing, params.cq_off.ring_mask);
+    m_cqes = ringPointer<struct io_uring_cqe>(m_cqRing, params.cq_off.cqes);
+    m_entries = params.sq_entries;
+}
+
+IoUring::~IoUring()
+{
+    release();
+}
+
+void IoUring::release()
+{
+    if (m_sqes != MAP_FAILED)
+        munmap(m_sqes, m_sqesSize);
+    if (m_cqRing != MAP_FAILED && m_cqRing != m_sqRing)
+        munmap(m_cqRing, m_cqRingSize);
+    if (m_sqRing != MAP_FAILED)
+        munmap(m_sqRing, m_sqRingSize);
+    m_sqes = m_cqRing = m_sqRing = MAP_FAILED;
+    if (m_fd >= 0)
+        close(m_fd);
+    m_fd = -1;
+}
+
+/**
+ * Calls statx for count paths relative to dirfd.
+ * The requests are submitted in batches of up to the ring size, so the kernel
+ * can work on them concurrently and only one system call is needed per batch.
+ * results[i] receives 0 or the negated errno value that a synchronous statx call
+ * of paths[i] would have set.
+ * Returns false if the requests could not be submitted. In that case the ring
+ * becomes invalid and the caller must fall back to statx.
+ */
+bool IoUring::statx(int dirfd, const char *const *paths, int count, unsigned int mask,
+                    struct statx *buffers, int *results)
+{
+    Q_ASSERT(isValid());
+    struct io_uring_sqe *sqes = static_cast<struct io_uring_sqe *>(m_sqes);
+    struct io_uring_cqe *cqes = static_cast<struct io_uring_cqe *>(m_cqes);
+    int submitted = 0;
+    while (submitted < count) {
+        const unsigned int batchSize = qMin(unsigned(count - submitted), m_entries);
+        unsigned int tail = *m_sqTail;
+        for (unsigned int i = 0; i < batchSize; ++i, ++tail) {
+            const int k = submitted + int(i);
+            const unsigned int index = tail & *m_sqMask;
+            struct io_uring_sqe *sqe = &sqes[index];
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = IORING_OP_STATX;
+            sqe->fd = dirfd;
+            sqe->addr = reinterpret_cast<quint64>(paths[k]);
+            sqe->len = mask;
+            sqe->off = reinterpret_cast<quint64>(&buffers[k]);
+            sqe->statx_flags = 0;
+            sqe->user_data = quint64(k);
+            m_sqArray[index] = index;
+        }
+        __atomic_store_n(m_sqTail, tail, __ATOMIC_RELEASE);
+
+        unsigned int completed = 0;
+        unsigned int toSubmit = batchSize;
+        while (completed < batchSize) {
+            const int ret = ioUringEnter(m_fd, toSubmit, batchSize - completed,
+                                         IORING_ENTER_GETEVENTS);
+            if (ret < 0) {
+                if (errno == EINTR)
+                    continue;
+                // The requests are lost. Let the caller redo everything synchronously.
+                release();
+                return false;
+            }
+            toSubmit -= qMin(unsigned(ret), toSubmit);
+
+            unsigned int head = *m_cqHead;
+            const unsigned int cqTail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+            for (; head != cqTail; ++head, ++completed) {
+                const struct io_uring_cqe &cqe = cqes[head & *m_cqMask];
+                results[cqe.user_data] = cqe.res;
+            }
+            __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+        }
+        submitted += int(batchSize);
+    }
+    return true;
+}
+
+} // namespace NMakeFile
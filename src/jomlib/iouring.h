@@ -0,0 +1,77 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of jom.
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+
+#ifndef IOURING_H
+#define IOURING_H
+
+#include <QtGlobal>
+
+struct statx;
+
+namespace NMakeFile {
+
+/**
+ * Minimal io_uring instance that runs batches of statx calls asynchronously.
+ * It talks to the kernel through the raw system calls, so liburing is not needed.
+ * If isValid() returns false, io_uring is not available and the caller should
+ * fall back to synchronous calls.
+ */
+class IoUring
+{
+public:
+    explicit IoUring(unsigned int entries = 256);
+    ~IoUring();
+
+    bool isValid() const { return m_fd >= 0; }
+
+    bool statx(int dirfd, const char *const *paths, int count, unsigned int mask,
+               struct statx *buffers, int *results);
+
+private:
+    Q_DISABLE_COPY(IoUring)
+    void release();
+
+    int m_fd;
+    unsigned int m_entries;
+    void *m_sqRing;
+    void *m_cqRing;
+    size_t m_sqRingSize;
+    size_t m_cqRingSize;
+    void *m_sqes;
+    size_t m_sqesSize;
+    unsigned int *m_sqHead;
+    unsigned int *m_sqTail;
+    unsigned int *m_sqMask;
+    unsigned int *m_sqArray;
+    unsigned int *m_cqHead;
+    unsigned int *m_cqTail;
+    unsigned int *m_cqMask;
+    void *m_cqes;
+};
+
+} // namespace NMakeFile
+
+#endif // IOURING_H
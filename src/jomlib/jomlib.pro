@@ -54,21 +54,39 @@ win32-* {
         iocompletionport.h
     SOURCES += \
         jomprocess.cpp \
-        iocompletionport.cpp
+        iocompletionport.cpp \
+        fastfileinfo_win.cpp \
+        filetime.cpp
 } else {
     DEFINES += USE_QPROCESS
     SOURCES += \
-        jomprocess_qt.cpp
+        jomprocess_qt.cpp \
+        fastfileinfo_unix.cpp \
+        filetime_unix.cpp
+    linux {
+        load(configure)
+        qtCompileTest(io_uring)
+    }
+    config_io_uring {
+        DEFINES += JOM_HAVE_IO_URING
+        HEADERS += iouring.h
+        SOURCES += iouring.cpp
+    }
 }
 
 HEADERS +=  \
+    buildlog.h \
+    contenthashes.h \
     fastfileinfo.h \
+    fastfileinfo_p.h \
     filetime.h \
     helperfunctions.h \
     jobserver.h \
     makefile.h \
+    makefilecache.h \
     makefilefactory.h \
     makefilelinereader.h \
+    makefiletokenizer.h \
     macrotable.h \
     exception.h \
     dependencygraph.h \
@@ -84,14 +102,17 @@ HEADERS +=  \
     jobclientacquirehelper.h
 
 SOURCES += \
+    buildlog.cpp \
+    contenthashes.cpp \
     fastfileinfo.cpp \
-    filetime.cpp \
     helperfunctions.cpp \
     jobserver.cpp \
     macrotable.cpp \
     makefile.cpp \
+    makefilecache.cpp \
     makefilefactory.cpp \
     makefilelinereader.cpp \
+    makefiletokenizer.cpp \
     exception.cpp \
     dependencygraph.cpp \
     options.cpp \
@@ -25,9 +25,10 @@
 
 #include "macrotable.h"
 #include "exception.h"
+#include "makefiletokenizer.h"
 
+#include <QDataStream>
 #include <QStringList>
-#include <QRegExp>
 #include <QDebug>
 
 namespace NMakeFile {
@@ -79,13 +80,12 @@ void MacroTable::defineEnvironmentMacroValue(const QString& name, const QString&
 
 bool MacroTable::isMacroNameValid(const QString& name) const
 {
-    static QRegExp rexMacroIdentifier;
-    if (rexMacroIdentifier.isEmpty()) {
-        rexMacroIdentifier.setPattern(QLatin1String("([A-Z]|_|)(\\w|\\.)+"));
-        rexMacroIdentifier.setCaseSensitivity(Qt::CaseInsensitive);
-    }
-
-    return rexMacroIdentifier.exactMatch(name);
+    if (name.isEmpty())
+        return false;
+    for (const QChar *ch = name.constData(), *end = ch + name.length(); ch != end; ++ch)
+        if (!MakefileTokenizer::isWordCharacter(*ch) && *ch != QLatin1Char('.'))
+            return false;
+    return true;
 }
 
 /**
@@ -164,6 +164,7 @@ MacroTable::MacroData* MacroTable::internalSetMacroValue(const QString& name, co
     result = &m_macros[expandedName];
     if (!result->isReadOnly)
         result->value = newValue;
+    invalidateExpansionCache(expandedName);
 
     return result;
 }
@@ -176,16 +177,25 @@ bool MacroTable::isMacroDefined(const QString& name) const
 void MacroTable::undefineMacro(const QString& name)
 {
     m_macros.remove(name);
+    invalidateExpansionCache(name);
 }
 
 QString MacroTable::expandMacros(const QString& str, bool inDependentsLine) const
 {
     QSet<QString> usedMacros;
-    return expandMacros(str, inDependentsLine, usedMacros);
+    return expandMacros(str, inDependentsLine, usedMacros, 0);
 }
 
-QString MacroTable::expandMacros(const QString& str, bool inDependentsLine, QSet<QString>& usedMacros) const
+/**
+ * Expands the macros in str.
+ * The names of all macros the result depends on are added to dependencies.
+ */
+QString MacroTable::expandMacros(const QString& str, bool inDependentsLine, QSet<QString>& usedMacros,
+                                 QSet<QString> *dependencies) const
 {
+    if (!str.contains(QLatin1Char('$')))
+        return str;
+
     QString ret;
     ret.reserve(str.count());
 
@@ -241,14 +251,14 @@ QString MacroTable::expandMacros(const QString& str, bool inDependentsLine, QSet
                     break;
                 default:
                     {
-                        QString macroValue = cycleCheckedMacroValue(macroName, usedMacros);
-                        macroValue = expandMacros(macroValue, inDependentsLine, usedMacros);
+                        Substitution substitution;
+                        QString substitutionText;
                         if (macroNameEnd != macroInvokationEnd) {
-                            const Substitution s = parseSubstitutionStatement(str, macroNameEnd + 1, macroInvokationEnd);
-                            applySubstitution(s, macroValue);
+                            substitution = parseSubstitutionStatement(str, macroNameEnd + 1, macroInvokationEnd);
+                            substitutionText = str.mid(macroNameEnd + 1, macroInvokationEnd - macroNameEnd - 1);
                         }
-                        usedMacros.remove(macroName);
-                        ret.append(macroValue);
+                        ret.append(expandedMacroValue(macroName, substitution, substitutionText,
+                                                      inDependentsLine, usedMacros, dependencies));
                     }
                 }
                 i = macroInvokationEnd;
@@ -278,10 +288,8 @@ QString MacroTable::expandMacros(const QString& str, bool inDependentsLine, QSet
             } else if (str.at(i).isLetterOrNumber()) {
                 // found single character macro invocation a la $X
                 const QString macroName = str.at(i);
-                QString macroValue = cycleCheckedMacroValue(macroName, usedMacros);
-                macroValue = expandMacros(macroValue, inDependentsLine, usedMacros);
-                usedMacros.remove(macroName);
-                ret.append(macroValue);
+                ret.append(expandedMacroValue(macroName, Substitution(), QString(),
+                                              inDependentsLine, usedMacros, dependencies));
             } else {
                 switch (str.at(i).toLatin1())
                 {
@@ -316,6 +324,66 @@ QString MacroTable::expandMacros(const QString& str, bool inDependentsLine, QSet
     return ret;
 }
 
+/**
+ * Returns the fully expanded value of a macro invocation like $(NAME) or $(NAME:before=after).
+ *
+ * The results are cached together with the names of all macros they were built from,
+ * including undefined ones. Changing or undefining one of those macros drops the entry.
+ */
+QString MacroTable::expandedMacroValue(const QString& macroName, const Substitution& substitution,
+                                       const QString& substitutionText, bool inDependentsLine,
+                                       QSet<QString>& usedMacros, QSet<QString> *dependencies) const
+{
+    QString cacheKey;
+    cacheKey.reserve(macroName.length() + substitutionText.length() + 2);
+    cacheKey += inDependentsLine ? QLatin1Char('1') : QLatin1Char('0');
+    cacheKey += macroName;
+    if (!substitutionText.isEmpty()) {
+        cacheKey += QLatin1Char(':');
+        cacheKey += substitutionText;
+    }
+
+    QHash<QString, ExpansionCacheEntry>::const_iterator it = m_expansionCache.constFind(cacheKey);
+    if (it != m_expansionCache.constEnd()) {
+        if (usedMacros.contains(macroName)) {
+            QString msg = QLatin1String("Cycle in macro detected when trying to invoke $(%1).");
+            throw Exception(msg.arg(macroName));
+        }
+        if (dependencies)
+            dependencies->unite(it->dependencies);
+        return it->value;
+    }
+
+    ExpansionCacheEntry entry;
+    if (substitutionText.isEmpty()) {
+        entry.value = cycleCheckedMacroValue(macroName, usedMacros);
+        entry.dependencies.insert(macroName);
+        entry.value = expandMacros(entry.value, inDependentsLine, usedMacros, &entry.dependencies);
+        usedMacros.remove(macroName);
+    } else {
+        entry.value = expandedMacroValue(macroName, Substitution(), QString(), inDependentsLine,
+                                         usedMacros, &entry.dependencies);
+        applySubstitution(substitution, entry.value);
+    }
+
+    foreach (const QString &dependency, entry.dependencies)
+        m_expansionCacheKeysByMacro[dependency].insert(cacheKey);
+    m_expansionCache.insert(cacheKey, entry);
+    if (dependencies)
+        dependencies->unite(entry.dependencies);
+    return entry.value;
+}
+
+/**
+ * Drops all cached expansions that depend on the given macro.
+ */
+void MacroTable::invalidateExpansionCache(const QString& macroName)
+{
+    const QSet<QString> cacheKeys = m_expansionCacheKeysByMacro.take(macroName);
+    foreach (const QString &cacheKey, cacheKeys)
+        m_expansionCache.remove(cacheKey);
+}
+
 QString MacroTable::cycleCheckedMacroValue(const QString& macroName, QSet<QString>& usedMacros) const
 {
     if (usedMacros.contains(macroName)) {
@@ -334,6 +402,49 @@ void MacroTable::dump() const
     }
 }
 
+/**
+ * Writes the macros and the environment to the stream.
+ */
+void MacroTable::save(QDataStream &stream) const
+{
+    stream << quint32(m_macros.count());
+    QHash<QString, MacroData>::const_iterator it = m_macros.constBegin();
+    for (; it != m_macros.constEnd(); ++it)
+        stream << it.key() << it->isEnvironmentVariable << it->isReadOnly << it->value;
+
+    stream << quint32(m_environment.count());
+    ProcessEnvironment::const_iterator envIt = m_environment.constBegin();
+    for (; envIt != m_environment.constEnd(); ++envIt)
+        stream << envIt.key().toQString() << envIt.value();
+}
+
+/**
+ * Replaces the macros and the environment with the ones read from the stream.
+ */
+void MacroTable::load(QDataStream &stream)
+{
+    m_macros.clear();
+    m_environment.clear();
+    m_expansionCache.clear();
+    m_expansionCacheKeysByMacro.clear();
+
+    quint32 count;
+    stream >> count;
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i) {
+        QString name;
+        MacroData macroData;
+        stream >> name >> macroData.isEnvironmentVariable >> macroData.isReadOnly >> macroData.value;
+        m_macros.insert(name, macroData);
+    }
+
+    stream >> count;
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i) {
+        QString name, value;
+        stream >> name >> value;
+        m_environment.insert(name, value);
+    }
+}
+
 /**
  * Invokes a macro value substitution.
  *
@@ -31,6 +31,10 @@
 #include <QtCore/QSet>
 #include <QtCore/QStringList>
 
+QT_BEGIN_NAMESPACE
+class QDataStream;
+QT_END_NAMESPACE
+
 namespace NMakeFile {
 
 class MacroTable
@@ -54,6 +58,8 @@ public:
     void undefineMacro(const QString& name);
     QString expandMacros(const QString& str, bool inDependentsLine = false) const;
     void dump() const;
+    void save(QDataStream &stream) const;
+    void load(QDataStream &stream);
 
     struct Substitution
     {
@@ -76,13 +82,26 @@ private:
         QString value;
     };
 
+    struct ExpansionCacheEntry
+    {
+        QString value;
+        QSet<QString> dependencies;
+    };
+
     MacroData* internalSetMacroValue(const QString& name, const QString& value);
     void setEnvironmentVariable(const QString& name, const QString& value);
-    QString expandMacros(const QString& str, bool inDependentsLine, QSet<QString>& usedMacros) const;
+    QString expandMacros(const QString& str, bool inDependentsLine, QSet<QString>& usedMacros,
+                         QSet<QString> *dependencies) const;
+    QString expandedMacroValue(const QString& macroName, const Substitution& substitution,
+                               const QString& substitutionText, bool inDependentsLine,
+                               QSet<QString>& usedMacros, QSet<QString> *dependencies) const;
     QString cycleCheckedMacroValue(const QString& macroName, QSet<QString>& usedMacros) const;
+    void invalidateExpansionCache(const QString& macroName);
 
     QHash<QString, MacroData>   m_macros;
     ProcessEnvironment          m_environment;
+    mutable QHash<QString, ExpansionCacheEntry> m_expansionCache;
+    mutable QHash<QString, QSet<QString> >      m_expansionCacheKeysByMacro;
 };
 
 } // namespace NMakeFile
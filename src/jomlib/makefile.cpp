@@ -24,14 +24,17 @@
 ****************************************************************************/
 
 #include "makefile.h"
+#include "buildlog.h"
 #include "exception.h"
 #include "options.h"
+#include "fastfileinfo.h"
 
 #include <QFileInfo>
 #include <QDebug>
 #include <QDir>
 
 #include <limits>
+#include <algorithm>
 
 namespace NMakeFile {
 
@@ -112,12 +115,43 @@ void Command::evaluateModifiers()
 
 DescriptionBlock::DescriptionBlock(Makefile* mkfile)
 :   m_bFileExists(false),
-    m_bVisitedByCycleCheck(false),
+    m_bInferenceRulesPreselected(false),
+    m_bRestat(false),
+    m_graphNodeId(std::numeric_limits<quint32>::max()),
+    m_commandHash(0),
     m_canAddCommands(ACSUnknown),
-    m_pMakefile(mkfile)
+    m_cycleCheckState(CCSUnvisited),
+    m_pMakefile(mkfile),
+    m_dependentTargetsGeneration(0),
+    m_bIgnoreTimeStampsInFileNameMacros(false)
 {
 }
 
+/**
+ * Returns the targets of m_dependents. The vector has one entry per dependent,
+ * which is 0 for dependents that are plain files.
+ *
+ * Each dependent name is resolved only once. Appending to m_dependents is picked up
+ * automatically, other modifications must be followed by invalidateDependentTargets().
+ * All entries are resolved again when a new target has been added to the makefile.
+ */
+const QVector<DescriptionBlock*> &DescriptionBlock::dependentTargets()
+{
+    const uint generation = m_pMakefile->targetGeneration();
+    if (m_dependentTargetsGeneration != generation
+            || m_dependentTargets.count() > m_dependents.count())
+    {
+        m_dependentTargets.clear();
+        m_dependentTargetsGeneration = generation;
+    }
+    if (m_dependentTargets.count() < m_dependents.count()) {
+        m_dependentTargets.reserve(m_dependents.count());
+        for (int i = m_dependentTargets.count(); i < m_dependents.count(); ++i)
+            m_dependentTargets.append(m_pMakefile->resolveDependent(m_dependents.at(i)));
+    }
+    return m_dependentTargets;
+}
+
 void DescriptionBlock::setTargetName(const QString& name)
 {
     m_targetName = name;
@@ -133,6 +167,7 @@ void DescriptionBlock::expandFileNameMacrosForDependents()
         QString& dependent = *it;
         expandFileNameMacros(dependent, -1, true);
     }
+    invalidateDependentTargets();
 }
 
 void DescriptionBlock::expandFileNameMacros()
@@ -156,6 +191,18 @@ void DescriptionBlock::expandFileNameMacros()
     }
 }
 
+/**
+ * Expands the file name macros in the commands like expandFileNameMacros() does,
+ * except that $? expands to all dependents. The result does not depend on time stamps
+ * and can be compared between jom runs.
+ */
+void DescriptionBlock::expandFileNameMacrosIgnoringTimeStamps()
+{
+    m_bIgnoreTimeStampsInFileNameMacros = true;
+    expandFileNameMacros();
+    m_bIgnoreTimeStampsInFileNameMacros = false;
+}
+
 void DescriptionBlock::expandFileNameMacros(Command& command, int depIdx)
 {
     expandFileNameMacros(command.m_commandLine, depIdx, false);
@@ -344,6 +391,10 @@ QStringList DescriptionBlock::getFileNameMacroValues(const QStringRef& str, int&
                     throw Exception(QLatin1String("Macro $? not allowed here."));
                 }
                 replacementLength = 1;
+                if (m_bIgnoreTimeStampsInFileNameMacros) {
+                    results = dependentCandidates;
+                    break;
+                }
                 FileTime targetTimeStamp = FastFileInfo(targetName()).lastModified();
                 foreach (const QString& dependentName, dependentCandidates) {
                     FileTime dependentTimeStamp = FastFileInfo(dependentName).lastModified();
@@ -385,6 +436,21 @@ bool InferenceRule::operator == (const InferenceRule& rhs) const
            m_priority == rhs.m_priority;
 }
 
+/**
+ * Returns the name of the rule as it is written in the makefile, e.g. ".c.obj".
+ */
+QString InferenceRule::name() const
+{
+    QString result;
+    if (m_fromSearchPath != QLatin1String("."))
+        result += QLatin1Char('{') + m_fromSearchPath + QLatin1Char('}');
+    result += m_fromExtension;
+    if (m_toSearchPath != QLatin1String("."))
+        result += QLatin1Char('{') + m_toSearchPath + QLatin1Char('}');
+    result += m_toExtension;
+    return result;
+}
+
 /**
  * Returns the name of the inferred dependent if this rule was applied to the
  * target with the given name. The target name is assumed to be a file name.
@@ -405,6 +471,7 @@ QString InferenceRule::inferredDependent(const QString &targetName) const
 Makefile::Makefile(const QString &fileName)
 :   m_fileName(fileName),
     m_firstTarget(0),
+    m_targetGeneration(0),
     m_macroTable(0),
     m_options(0),
     m_parallelExecutionDisabled(false)
@@ -427,8 +494,31 @@ void Makefile::clear()
 
     m_firstTarget = 0;
     m_targets.clear();
+    m_resolvedDependents.clear();
+    ++m_targetGeneration;
     m_preciousTargets.clear();
+    m_restatNames.clear();
     m_inferenceRules.clear();
+    m_ruleCommandHashes.clear();
+}
+
+/**
+ * Returns the target for a dependent name or 0 if the dependent is a plain file.
+ * The result is cached until the next target is added.
+ */
+DescriptionBlock* Makefile::resolveDependent(const QString& dependentName) const
+{
+    QHash<QString, DescriptionBlock*>::const_iterator it = m_resolvedDependents.constFind(dependentName);
+    if (it != m_resolvedDependents.constEnd())
+        return it.value();
+
+    DescriptionBlock* result = target(dependentName);
+    if (!result) {
+        // We don't know dependent "foo" but it may have been defined as "C:\MySourceDir\foo"
+        result = target(dirPath() + QDir::separator() + dependentName);
+    }
+    m_resolvedDependents.insert(dependentName, result);
+    return result;
 }
 
 const QString &Makefile::dirPath() const
@@ -492,56 +582,106 @@ void Makefile::dumpInferenceRules() const
     }
 }
 
-void Makefile::filterRulesByDependent(QVector<InferenceRule*>& rules, const QString& targetName)
+/**
+ * Returns the inference rule that is applied to the target or 0 if there is none.
+ *
+ * A rule matches if its inferred dependent exists. Of all matching rules the one with
+ * the lowest priority value wins. For equal priorities the rule defined last wins.
+ * The existence checks go through the FastFileInfo cache and are skipped for rules
+ * that cannot win anymore.
+ */
+const InferenceRule *Makefile::findMatchingInferenceRule(DescriptionBlock *target) const
 {
-    QFileInfo fi(targetName);
-    QString targetFileName = fi.fileName();
-
-    QVector<InferenceRule*>::iterator it = rules.begin();
-    while (it != rules.end()) {
-        const InferenceRule* rule = *it;
-
-        // Thanks to Parser::preselectInferenceRules the target name
-        // is guaranteed to end with rule->m_toExtension.
-        QString baseName = targetFileName;
-        baseName.chop(rule->m_toExtension.length());
-        QString dependentName = rule->m_fromSearchPath + QDir::separator() +
-                                baseName + rule->m_fromExtension;
-
-        DescriptionBlock* depTarget = m_targets.value(dependentName);
-        if ((depTarget && depTarget->m_bFileExists) || QFile::exists(dependentName)) {
-            ++it;
+    const InferenceRule *matchingRule = 0;
+    foreach (const InferenceRule *rule, target->m_inferenceRules) {
+        if (matchingRule && rule->m_priority > matchingRule->m_priority)
             continue;
-        }
 
-        it = rules.erase(it);
-    }    
+        const QString dependentName = rule->inferredDependent(target->targetName());
+        const DescriptionBlock *depTarget = resolveDependent(dependentName);
+        if ((depTarget && depTarget->m_bFileExists) || FastFileInfo(dependentName).exists())
+            matchingRule = rule;
+    }
+    return matchingRule;
 }
 
-void Makefile::applyInferenceRules(QList<DescriptionBlock*> targets)
+/**
+ * Applies the matching inference rules to the given targets.
+ *
+ * Targets with a matching batch mode rule are collected until applyBatchModeRules
+ * is called. Those targets are returned.
+ */
+QList<DescriptionBlock*> Makefile::applyInferenceRules(QList<DescriptionBlock*> targets)
 {
+    QList<DescriptionBlock*> batchModeTargets;
     foreach (DescriptionBlock *t, targets)
-        applyInferenceRules(t);
-
-    if (!m_batchModeTargets.isEmpty()) {
-        foreach (const InferenceRule *rule, m_batchModeRules) {
-            QList<DescriptionBlock*> allBatchTargets = m_batchModeTargets.values(rule);
-            int filesPerBatch = qMax(1, qRound(float(allBatchTargets.count()) / float(g_options.maxNumberOfJobs)));
-            do {
-                QList<DescriptionBlock*> batch;
-                for (int i=0; i < filesPerBatch && !allBatchTargets.isEmpty(); ++i)
-                    batch.append( allBatchTargets.takeFirst() );
-                applyInferenceRule(batch, rule);
-            } while (!allBatchTargets.isEmpty());
-        }
-        m_batchModeRules.clear();
-        m_batchModeTargets.clear();
-    }
+        if (applyInferenceRules(t))
+            batchModeTargets.append(t);
+    return batchModeTargets;
 }
 
-static bool infRulesPriorityGreaterThan(const InferenceRule *lhs, const InferenceRule *rhs)
+struct BatchModeCandidate
+{
+    DescriptionBlock *target;
+    quint32 cost;
+};
+
+static bool batchModeCandidateCostGreaterThan(const BatchModeCandidate &lhs,
+                                              const BatchModeCandidate &rhs)
 {
-    return lhs->m_priority > rhs->m_priority;
+    return lhs.cost > rhs.cost;
+}
+
+/**
+ * Distributes the collected batch mode targets of each rule over at most numberOfBatches
+ * batches and applies the rule to each batch.
+ *
+ * The cost of a target is its recorded duration. Targets without a recorded duration
+ * get the average cost of the other targets. The most expensive targets are placed first,
+ * each into the batch with the lowest total cost so far.
+ */
+void Makefile::applyBatchModeRules(int numberOfBatches, const QHash<QString, quint32> &durations)
+{
+    foreach (const InferenceRule *rule, m_batchModeRules) {
+        const QList<DescriptionBlock*> ruleTargets = m_batchModeTargets.values(rule);
+        QVector<BatchModeCandidate> candidates;
+        candidates.reserve(ruleTargets.count());
+        quint64 knownCostSum = 0;
+        int knownCostCount = 0;
+        foreach (DescriptionBlock *target, ruleTargets) {
+            BatchModeCandidate candidate;
+            candidate.target = target;
+            candidate.cost = durations.value(target->targetName().toLower(), 0);
+            if (candidate.cost) {
+                knownCostSum += candidate.cost;
+                ++knownCostCount;
+            }
+            candidates.append(candidate);
+        }
+
+        const quint32 defaultCost = knownCostCount ? quint32(knownCostSum / knownCostCount) : 1;
+        for (int i = 0; i < candidates.count(); ++i)
+            if (!candidates.at(i).cost)
+                candidates[i].cost = qMax<quint32>(1, defaultCost);
+        std::stable_sort(candidates.begin(), candidates.end(), batchModeCandidateCostGreaterThan);
+
+        const int batchCount = qBound(1, numberOfBatches, candidates.count());
+        QVector<QList<DescriptionBlock*> > batches(batchCount);
+        QVector<quint64> batchCosts(batchCount, 0);
+        foreach (const BatchModeCandidate &candidate, candidates) {
+            int cheapest = 0;
+            for (int i = 1; i < batchCount; ++i)
+                if (batchCosts.at(i) < batchCosts.at(cheapest))
+                    cheapest = i;
+            batches[cheapest].append(candidate.target);
+            batchCosts[cheapest] += candidate.cost;
+        }
+
+        for (int i = 0; i < batchCount; ++i)
+            applyInferenceRule(batches[i], rule);
+    }
+    m_batchModeRules.clear();
+    m_batchModeTargets.clear();
 }
 
 void Makefile::addInferenceRule(InferenceRule *rule)
@@ -571,6 +711,67 @@ void Makefile::addPreciousTarget(const QString& targetName)
         m_preciousTargets.append(targetName);
 }
 
+/**
+ * Adds a target or an inference rule from the .RESTAT directive.
+ */
+void Makefile::addRestatName(const QString& name)
+{
+    m_restatNames.insert(name.toLower());
+}
+
+/**
+ * Returns true if the outputs of the target are checked for changes after the target
+ * has been built. Targets whose outputs didn't change don't cause rebuilds of
+ * the targets depending on them.
+ */
+bool Makefile::isRestatTarget(const DescriptionBlock* target) const
+{
+    return target->m_bRestat || m_restatNames.contains(target->targetName().toLower());
+}
+
+/**
+ * Returns a hash value of the commands the target would execute, or 0 if it has none.
+ * The target itself is not modified.
+ *
+ * The file name macros in the commands only depend on the target name and the dependents.
+ * Therefore the commands are hashed before the file name macros are expanded, and combined
+ * with the names. The hash of an inference rule's commands is computed once per rule.
+ * That way the result only changes if the makefile or the macro values change.
+ */
+quint64 Makefile::commandHash(DescriptionBlock* target)
+{
+    const InferenceRule *rule = target->m_inferenceRules.isEmpty()
+            ? 0 : findMatchingInferenceRule(target);
+    if (!rule) {
+        if (target->m_commands.isEmpty())
+            return 0;
+        return BuildLog::hashTargetCommands(BuildLog::hashCommands(target->m_commands),
+                                            target->targetName(), target->m_dependents);
+    }
+
+    QHash<const InferenceRule*, quint64>::iterator it = m_ruleCommandHashes.find(rule);
+    if (it == m_ruleCommandHashes.end()) {
+        QList<Command> commands = rule->m_commands;
+        QList<Command>::iterator cit = commands.begin();
+        QList<Command>::iterator citEnd = commands.end();
+        for (; cit != citEnd; ++cit) {
+            Command& command = *cit;
+            foreach (InlineFile* inlineFile, command.m_inlineFiles)
+                inlineFile->m_content = m_macroTable->expandMacros(inlineFile->m_content);
+            command.m_commandLine = m_macroTable->expandMacros(command.m_commandLine);
+        }
+        it = m_ruleCommandHashes.insert(rule, commands.isEmpty() ? 0 : BuildLog::hashCommands(commands));
+    }
+    if (!it.value())
+        return 0;
+
+    QStringList dependents = target->m_dependents;
+    const QString inferredDependent = rule->inferredDependent(target->targetName());
+    if (!dependents.contains(inferredDependent))
+        dependents.append(inferredDependent);
+    return BuildLog::hashTargetCommands(it.value(), target->targetName(), dependents);
+}
+
 void Makefile::invalidateTimeStamps()
 {
     QHash<QString, DescriptionBlock*>::iterator it = m_targets.begin();
@@ -582,35 +783,35 @@ void Makefile::invalidateTimeStamps()
     }
 }
 
-void Makefile::applyInferenceRules(DescriptionBlock* target)
+/**
+ * Applies the matching inference rule to the target.
+ * Returns true if the target has been collected for a batch mode rule.
+ */
+bool Makefile::applyInferenceRules(DescriptionBlock* target)
 {
     if (target->m_inferenceRules.isEmpty())
-        return;
-
-    QVector<InferenceRule *> rules = target->m_inferenceRules;
-    filterRulesByDependent(rules, target->targetName());
-    qStableSort(rules.begin(), rules.end(), infRulesPriorityGreaterThan);
+        return false;
 
-    if (rules.isEmpty()) {
+    const InferenceRule *matchingRule = findMatchingInferenceRule(target);
+    if (!matchingRule) {
         //qDebug() << "XXX" << target->m_targetName << "no matching inference rule found.";
-        return;
+        return false;
+    }
+
+    if (m_options->batchModeEnabled && matchingRule->m_batchMode) {
+        m_batchModeRules.insert(matchingRule);
+        m_batchModeTargets.insert(matchingRule, target);
+        return true;
     }
 
-    // take the last matching inference rule
-    const InferenceRule* matchingRule = rules.last();
     applyInferenceRule(target, matchingRule);
-    target->m_inferenceRules.clear();
+    return false;
 }
 
-void Makefile::applyInferenceRule(DescriptionBlock* target, const InferenceRule* rule, bool applyingBatchMode)
+void Makefile::applyInferenceRule(DescriptionBlock* target, const InferenceRule* rule)
 {
-    if (!applyingBatchMode && m_options->batchModeEnabled && rule->m_batchMode) {
-        m_batchModeRules.insert(rule);
-        m_batchModeTargets.insert(rule, target);
-        return;
-    }
-
     target->m_inferenceRules.clear();
+    target->m_bRestat = m_restatNames.contains(rule->name().toLower());
     //qDebug() << "----> applyInferenceRule for" << target->targetName();
 
     QString inferredDependent = rule->inferredDependent(target->targetName());
@@ -639,8 +840,12 @@ void Makefile::applyInferenceRule(QList<DescriptionBlock*> &batch, const Inferen
 {
     QString inferredDependents;
     DescriptionBlock *executingTarget = batch.first();
+    executingTarget->m_batchTargetNames.clear();
+    executingTarget->m_bRestat = m_restatNames.contains(rule->name().toLower());
     foreach (DescriptionBlock *target, batch) {
         target->m_inferenceRules.clear();
+        if (target != executingTarget)
+            executingTarget->m_batchTargetNames.append(target->targetName());
         QString inferredDependent = rule->inferredDependent(target->targetName());
         if (!executingTarget->m_dependents.contains(inferredDependent))
             executingTarget->m_dependents.append(inferredDependent);
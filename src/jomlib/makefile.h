@@ -82,6 +82,7 @@ public:
 
     void expandFileNameMacrosForDependents();
     void expandFileNameMacros();
+    void expandFileNameMacrosIgnoringTimeStamps();
 
     void setTargetName(const QString& name);
 
@@ -99,15 +100,25 @@ public:
      */
     Makefile* makefile() const { return m_pMakefile; }
 
+    const QVector<DescriptionBlock*> &dependentTargets();
+    void invalidateDependentTargets() { m_dependentTargets.clear(); }
+
     QStringList m_dependents;
     FileTime m_timeStamp;
     bool m_bFileExists;
-    bool m_bVisitedByCycleCheck;
+    bool m_bInferenceRulesPreselected;
     QVector<InferenceRule*> m_inferenceRules;
+    QStringList m_batchTargetNames;     // other targets that are built by this target's batch
+    bool m_bRestat;                     // built by an inference rule listed in .RESTAT
+    quint32 m_graphNodeId;              // index of this target's node in the DependencyGraph
+    quint64 m_commandHash;              // hash of the commands for the build log, 0 if unknown
 
     enum AddCommandsState { ACSUnknown, ACSEnabled, ACSDisabled };
     AddCommandsState m_canAddCommands;
 
+    enum CycleCheckState { CCSUnvisited, CCSVisiting, CCSDone };
+    CycleCheckState m_cycleCheckState;
+
 private:
     void expandFileNameMacros(Command& command, int depIdx);
     void expandFileNameMacros(QString& str, int depIdx, bool dependentsForbidden);
@@ -117,6 +128,9 @@ private:
 private:
     QString m_targetName;
     Makefile* m_pMakefile;
+    QVector<DescriptionBlock*> m_dependentTargets;  // resolved prefix of m_dependents
+    uint m_dependentTargetsGeneration;
+    bool m_bIgnoreTimeStampsInFileNameMacros;
 };
 
 class InferenceRule : public CommandContainer {
@@ -127,6 +141,7 @@ public:
     bool operator == (const InferenceRule& rhs) const;
 
     QString inferredDependent(const QString &targetName) const;
+    QString name() const;
 
     bool m_batchMode;
     QString m_fromSearchPath;
@@ -147,10 +162,12 @@ public:
     void append(DescriptionBlock* target)
     {
         m_targets[target->targetName().toLower()] = target;
+        m_resolvedDependents.clear();
+        ++m_targetGeneration;
         if (!m_firstTarget) m_firstTarget = target;
     }
 
-    DescriptionBlock* firstTarget()
+    DescriptionBlock* firstTarget() const
     {
         return m_firstTarget;
     }
@@ -171,6 +188,13 @@ public:
         return result;
     }
 
+    DescriptionBlock* resolveDependent(const QString& dependentName) const;
+
+    /**
+     * Changes whenever a target is added.
+     */
+    uint targetGeneration() const { return m_targetGeneration; }
+
     const QHash<QString, DescriptionBlock*>& targets() const
     {
         return m_targets;
@@ -181,6 +205,11 @@ public:
         return m_preciousTargets;
     }
 
+    const QSet<QString>& restatNames() const
+    {
+        return m_restatNames;
+    }
+
     const QVector<InferenceRule *>& inferenceRules() const
     {
         return m_inferenceRules;
@@ -200,16 +229,20 @@ public:
     void dumpTargets() const;
     void dumpInferenceRules() const;
     void invalidateTimeStamps();
-    void applyInferenceRules(QList<DescriptionBlock*> targets);
+    QList<DescriptionBlock*> applyInferenceRules(QList<DescriptionBlock*> targets);
+    void applyBatchModeRules(int numberOfBatches, const QHash<QString, quint32> &durations);
     void addInferenceRule(InferenceRule *rule);
     void calculateInferenceRulePriorities(const QStringList &suffixes);
     void addPreciousTarget(const QString& targetName);
+    void addRestatName(const QString& name);
+    quint64 commandHash(DescriptionBlock* target);
+    bool isRestatTarget(const DescriptionBlock* target) const;
+    const InferenceRule *findMatchingInferenceRule(DescriptionBlock *target) const;
 
 private:
-    void filterRulesByDependent(QVector<InferenceRule*>& rules, const QString& targetName);
     QStringList findInferredDependents(InferenceRule* rule, const QStringList& dependents);
-    void applyInferenceRules(DescriptionBlock* target);
-    void applyInferenceRule(DescriptionBlock* target, const InferenceRule *rule, bool applyingBatchMode = false);
+    bool applyInferenceRules(DescriptionBlock* target);
+    void applyInferenceRule(DescriptionBlock* target, const InferenceRule *rule);
     void applyInferenceRule(QList<DescriptionBlock*> &batch, const InferenceRule *rule);
 
 private:
@@ -217,8 +250,12 @@ private:
     mutable QString m_dirPath;
     DescriptionBlock* m_firstTarget;
     QHash<QString, DescriptionBlock*> m_targets;
+    mutable QHash<QString, DescriptionBlock*> m_resolvedDependents;
+    uint m_targetGeneration;
     QStringList m_preciousTargets;
+    QSet<QString> m_restatNames;        // lower case target and inference rule names
     QVector<InferenceRule *> m_inferenceRules;
+    QHash<const InferenceRule*, quint64> m_ruleCommandHashes;
     MacroTable* m_macroTable;
     Options* m_options;
     QSet<const InferenceRule*> m_batchModeRules;
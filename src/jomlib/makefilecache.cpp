@@ -0,0 +1,359 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of jom.
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+
+#include "makefilecache.h"
+#include "fastfileinfo.h"
+#include "macrotable.h"
+#include "makefile.h"
+#include "options.h"
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QDataStream>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QSaveFile>
+
+#include <cstdio>
+#include <limits>
+
+namespace NMakeFile {
+
+static const quint32 cacheSignature = 0x6a6d6331;   // "jmc1"
+static const QDataStream::Version streamVersion = QDataStream::Qt_5_0;
+
+/**
+ * Environment variables that differ between otherwise identical jom runs.
+ * They are not part of the key, and their current values replace the cached ones.
+ */
+static bool isVolatileEnvironmentVariable(const QString &name)
+{
+    return name.compare(QLatin1String("_JOMSRVKEY_"), Qt::CaseInsensitive) == 0;
+}
+
+/**
+ * There's one snapshot per makefile. It is replaced whenever the makefile is parsed
+ * with a different key, so the cache directory doesn't grow.
+ */
+MakefileCache::MakefileCache(const QString &makefileName, const QByteArray &key)
+:   m_key(key)
+{
+    m_fileName = QFileInfo(makefileName).absoluteDir().filePath(
+                directoryName() + QLatin1Char('/') + QFileInfo(makefileName).fileName());
+}
+
+/**
+ * Returns the name of the directory that contains the snapshots,
+ * relative to the makefile's directory.
+ */
+QString MakefileCache::directoryName()
+{
+    return QStringLiteral(".jom_cache");
+}
+
+/**
+ * Returns the key for the snapshot of a makefile that is parsed with the given arguments
+ * and environment in the current directory.
+ * Returns an empty key, which disables the cache, if arguments are read from command files.
+ */
+QByteArray MakefileCache::createKey(const QStringList &commandLineArguments,
+                                    const ProcessEnvironment &environment)
+{
+    foreach (const QString &argument, commandLineArguments) {
+        if (argument.startsWith(QLatin1Char('@')))
+            return QByteArray();
+    }
+
+    QByteArray key;
+    QDataStream stream(&key, QIODevice::WriteOnly);
+    stream.setVersion(streamVersion);
+
+    // A different jom executable might parse differently.
+    const QString appFilePath = QCoreApplication::applicationFilePath();
+    stream << appFilePath
+           << quint64(FastFileInfo(appFilePath).lastModified().internalRepresentation())
+           << QDir::currentPath()
+           << commandLineArguments;
+    ProcessEnvironment::const_iterator it = environment.constBegin();
+    for (; it != environment.constEnd(); ++it) {
+        if (!isVolatileEnvironmentVariable(it.key().toQString()))
+            stream << it.key().toQString() << it.value();
+    }
+    return key;
+}
+
+/**
+ * Reads the recorded input files and returns true if none of them changed.
+ * Each file is stat'ed on its own. Reading whole directories into the FastFileInfo
+ * cache would be too expensive for include files from large SDK directories.
+ */
+bool MakefileCache::areInputFilesUnchanged(QDataStream &stream)
+{
+    quint32 count;
+    stream >> count;
+    for (quint32 i = 0; i < count; ++i) {
+        QString filePath;
+        bool exists;
+        quint64 lastModified;
+        qint64 size;
+        stream >> filePath >> exists >> lastModified >> size;
+        if (stream.status() != QDataStream::Ok)
+            return false;
+        const FastFileInfo fi(filePath, FastFileInfo::BypassCache);
+        if (fi.exists() != exists)
+            return false;
+        if (exists && (fi.lastModified().internalRepresentation() != lastModified
+                       || fi.size() != size))
+        {
+            return false;
+        }
+    }
+    return stream.status() == QDataStream::Ok;
+}
+
+/**
+ * Fills the empty makefile and the macro table from the snapshot.
+ * Returns false if there's no snapshot for the key, or if one of the input files changed.
+ * Then the makefile must be parsed.
+ * The messages of !MESSAGE directives are printed again.
+ */
+bool MakefileCache::load(Makefile *makefile, MacroTable *macroTable,
+                         const ProcessEnvironment &environment)
+{
+    if (m_key.isEmpty())
+        return false;
+    QFile file(m_fileName);
+    if (!file.open(QFile::ReadOnly))
+        return false;
+    const qint64 fileSize = file.size();
+    if (fileSize <= 0 || fileSize > std::numeric_limits<int>::max())
+        return false;
+    const uchar *mapping = file.map(0, fileSize);
+    if (!mapping)
+        return false;
+
+    const QByteArray data = QByteArray::fromRawData(reinterpret_cast<const char *>(mapping),
+                                                    int(fileSize));
+    QDataStream stream(data);
+    stream.setVersion(streamVersion);
+    quint32 signature;
+    QByteArray key;
+    stream >> signature >> key;
+    if (stream.status() != QDataStream::Ok || signature != cacheSignature || key != m_key)
+        return false;
+    if (!areInputFilesUnchanged(stream))
+        return false;
+
+    QStringList messages;
+    stream >> messages;
+    MacroTable cachedMacroTable;
+    cachedMacroTable.load(stream);
+    readMakefile(stream, makefile);
+    if (stream.status() != QDataStream::Ok) {
+        makefile->clear();
+        return false;
+    }
+
+    *macroTable = cachedMacroTable;
+    ProcessEnvironment cachedEnvironment = macroTable->environment();
+    foreach (const ProcessEnvironmentKey &variable, cachedEnvironment.keys()) {
+        if (isVolatileEnvironmentVariable(variable.toQString())) {
+            macroTable->undefineMacro(variable.toQString().toUpper());
+            cachedEnvironment.remove(variable);
+        }
+    }
+    macroTable->setEnvironment(cachedEnvironment);
+    ProcessEnvironment::const_iterator it = environment.constBegin();
+    for (; it != environment.constEnd(); ++it) {
+        if (isVolatileEnvironmentVariable(it.key().toQString())) {
+            macroTable->defineEnvironmentMacroValue(it.key().toQString(), it.value(),
+                                                    makefile->options()->overrideEnvVarMacros);
+        }
+    }
+
+    foreach (const QString &message, messages)
+        puts(qPrintable(message));
+    return true;
+}
+
+/**
+ * Writes the snapshot of the parsed makefile.
+ * The input files are the makefile, the include files, the files that were looked for
+ * and the directories that were searched for wildcards. Their time stamps and sizes
+ * must have been taken before they were read, so that changes during parsing
+ * invalidate the snapshot.
+ */
+bool MakefileCache::save(const Makefile *makefile, const QHash<QString, FastFileInfo> &inputFiles,
+                         const QStringList &messages)
+{
+    if (m_key.isEmpty())
+        return false;
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream.setVersion(streamVersion);
+    stream << cacheSignature << m_key;
+
+    stream << quint32(inputFiles.count());
+    QHash<QString, FastFileInfo>::const_iterator it = inputFiles.constBegin();
+    for (; it != inputFiles.constEnd(); ++it) {
+        stream << it.key() << it->exists()
+               << quint64(it->lastModified().internalRepresentation()) << it->size();
+    }
+
+    stream << messages;
+    makefile->macroTable()->save(stream);
+    writeMakefile(stream, makefile);
+
+    if (!QDir().mkpath(QFileInfo(m_fileName).absolutePath()))
+        return false;
+    QSaveFile saveFile(m_fileName);
+    if (!saveFile.open(QIODevice::WriteOnly))
+        return false;
+    saveFile.write(data);
+    return saveFile.commit();
+}
+
+void MakefileCache::writeCommands(QDataStream &stream, const QList<Command> &commands)
+{
+    stream << quint32(commands.count());
+    foreach (const Command &command, commands) {
+        stream << command.m_commandLine << quint32(command.m_maxExitCode)
+               << command.m_silent << command.m_singleExecution
+               << quint32(command.m_inlineFiles.count());
+        foreach (const InlineFile *inlineFile, command.m_inlineFiles) {
+            stream << inlineFile->m_keep << inlineFile->m_unicode
+                   << inlineFile->m_filename << inlineFile->m_content;
+        }
+    }
+}
+
+void MakefileCache::readCommands(QDataStream &stream, QList<Command> &commands)
+{
+    quint32 count;
+    stream >> count;
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i) {
+        commands.append(Command());
+        Command &command = commands.last();
+        quint32 maxExitCode, inlineFileCount;
+        stream >> command.m_commandLine >> maxExitCode
+               >> command.m_silent >> command.m_singleExecution
+               >> inlineFileCount;
+        command.m_maxExitCode = maxExitCode;
+        for (quint32 k = 0; k < inlineFileCount && stream.status() == QDataStream::Ok; ++k) {
+            InlineFile *inlineFile = new InlineFile;
+            stream >> inlineFile->m_keep >> inlineFile->m_unicode
+                   >> inlineFile->m_filename >> inlineFile->m_content;
+            command.m_inlineFiles.append(inlineFile);
+        }
+    }
+}
+
+void MakefileCache::writeMakefile(QDataStream &stream, const Makefile *makefile)
+{
+    const QVector<InferenceRule *> &rules = makefile->inferenceRules();
+    stream << quint32(rules.count());
+    foreach (const InferenceRule *rule, rules) {
+        writeCommands(stream, rule->m_commands);
+        stream << rule->m_batchMode
+               << rule->m_fromSearchPath << rule->m_fromExtension
+               << rule->m_toSearchPath << rule->m_toExtension
+               << qint32(rule->m_priority);
+    }
+
+    // The first target is the default target. It must be appended first.
+    QList<DescriptionBlock *> targets = makefile->targets().values();
+    if (DescriptionBlock *firstTarget = makefile->firstTarget()) {
+        targets.removeOne(firstTarget);
+        targets.prepend(firstTarget);
+    }
+    stream << quint32(targets.count());
+    foreach (const DescriptionBlock *target, targets) {
+        stream << target->targetName() << target->m_dependents;
+        writeCommands(stream, target->m_commands);
+        stream << target->m_bInferenceRulesPreselected
+               << qint32(target->m_canAddCommands)
+               << quint32(target->m_inferenceRules.count());
+        foreach (InferenceRule *rule, target->m_inferenceRules)
+            stream << qint32(rules.indexOf(rule));
+    }
+
+    stream << makefile->preciousTargets()
+           << QStringList(makefile->restatNames().toList())
+           << makefile->isParallelExecutionDisabled();
+}
+
+void MakefileCache::readMakefile(QDataStream &stream, Makefile *makefile)
+{
+    quint32 count;
+    stream >> count;
+    QVector<InferenceRule *> rules;
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i) {
+        InferenceRule *rule = new InferenceRule;
+        readCommands(stream, rule->m_commands);
+        qint32 priority;
+        stream >> rule->m_batchMode
+               >> rule->m_fromSearchPath >> rule->m_fromExtension
+               >> rule->m_toSearchPath >> rule->m_toExtension
+               >> priority;
+        rule->m_priority = priority;
+        makefile->addInferenceRule(rule);
+        rules.append(rule);
+    }
+
+    stream >> count;
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i) {
+        QString targetName;
+        stream >> targetName;
+        DescriptionBlock *target = new DescriptionBlock(makefile);
+        target->setTargetName(targetName);
+        stream >> target->m_dependents;
+        readCommands(stream, target->m_commands);
+        qint32 canAddCommands;
+        quint32 ruleCount;
+        stream >> target->m_bInferenceRulesPreselected >> canAddCommands >> ruleCount;
+        target->m_canAddCommands = DescriptionBlock::AddCommandsState(canAddCommands);
+        for (quint32 k = 0; k < ruleCount && stream.status() == QDataStream::Ok; ++k) {
+            qint32 ruleIndex;
+            stream >> ruleIndex;
+            if (ruleIndex < 0 || ruleIndex >= rules.count())
+                stream.setStatus(QDataStream::ReadCorruptData);
+            else
+                target->m_inferenceRules.append(rules.at(ruleIndex));
+        }
+        makefile->append(target);
+    }
+
+    QStringList preciousTargets, restatNames;
+    bool parallelExecutionDisabled;
+    stream >> preciousTargets >> restatNames >> parallelExecutionDisabled;
+    foreach (const QString &targetName, preciousTargets)
+        makefile->addPreciousTarget(targetName);
+    foreach (const QString &name, restatNames)
+        makefile->addRestatName(name);
+    makefile->setParallelExecutionDisabled(parallelExecutionDisabled);
+}
+
+} // namespace NMakeFile
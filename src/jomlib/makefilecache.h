@@ -0,0 +1,87 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of jom.
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+
+#ifndef MAKEFILECACHE_H
+#define MAKEFILECACHE_H
+
+#include "fastfileinfo.h"
+#include "processenvironment.h"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QHash>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+
+QT_BEGIN_NAMESPACE
+class QDataStream;
+QT_END_NAMESPACE
+
+namespace NMakeFile {
+
+class Command;
+class MacroTable;
+class Makefile;
+
+/**
+ * Persistent snapshot of a parsed makefile.
+ *
+ * The snapshot contains the targets, inference rules, dot directives and the macro table
+ * as they are after parsing. It is stored in the .jom_cache directory next to the makefile.
+ * The snapshot contains a key that covers the current directory, the jom executable,
+ * the command line arguments and the environment. Only the snapshot of the last key is kept.
+ * Besides that, the snapshot records every file and directory the parser looked at,
+ * with the time stamp and size they had when the parser looked at them.
+ * It is only used if all of them still have the same time stamp and size.
+ */
+class MakefileCache
+{
+public:
+    MakefileCache(const QString &makefileName, const QByteArray &key);
+
+    static QString directoryName();
+    static QByteArray createKey(const QStringList &commandLineArguments,
+                                const ProcessEnvironment &environment);
+
+    const QString &fileName() const { return m_fileName; }
+    bool load(Makefile *makefile, MacroTable *macroTable, const ProcessEnvironment &environment);
+    bool save(const Makefile *makefile, const QHash<QString, FastFileInfo> &inputFiles,
+              const QStringList &messages);
+
+private:
+    bool areInputFilesUnchanged(QDataStream &stream);
+    static void writeCommands(QDataStream &stream, const QList<Command> &commands);
+    static void readCommands(QDataStream &stream, QList<Command> &commands);
+    static void writeMakefile(QDataStream &stream, const Makefile *makefile);
+    static void readMakefile(QDataStream &stream, Makefile *makefile);
+
+private:
+    QString m_fileName;
+    QByteArray m_key;
+};
+
+} // namespace NMakeFile
+
+#endif // MAKEFILECACHE_H
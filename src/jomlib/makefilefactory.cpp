@@ -27,6 +27,7 @@
 #include "makefilefactory.h"
 #include "macrotable.h"
 #include "makefile.h"
+#include "makefilecache.h"
 #include "options.h"
 #include "parser.h"
 #include "preprocessor.h"
@@ -159,11 +160,24 @@ bool MakefileFactory::apply(const QStringList& commandLineArguments, Options **o
         m_makefile = new Makefile(filename);
         m_makefile->setOptions(options);
         m_makefile->setMacroTable(macroTable);
-        Preprocessor preprocessor;
-        preprocessor.setMacroTable(macroTable);
-        preprocessor.openFile(filename);
-        Parser parser;
-        parser.apply(&preprocessor, m_makefile, m_activeTargets);
+        const QByteArray cacheKey = options->useMakefileCache
+                ? MakefileCache::createKey(commandLineArguments, m_environment) : QByteArray();
+        MakefileCache cache(filename, cacheKey);
+        if (!cache.load(m_makefile, macroTable, m_environment)) {
+            Preprocessor preprocessor;
+            preprocessor.setMacroTable(macroTable);
+            preprocessor.openFile(filename);
+            Parser parser;
+            parser.apply(&preprocessor, m_makefile, m_activeTargets);
+            if (preprocessor.isResultReproducible()) {
+                QHash<QString, FastFileInfo> inputFiles = preprocessor.inputFiles();
+                const QHash<QString, FastFileInfo> &listedDirectories = parser.listedDirectories();
+                QHash<QString, FastFileInfo>::const_iterator it = listedDirectories.constBegin();
+                for (; it != listedDirectories.constEnd(); ++it)
+                    inputFiles.insert(it.key(), it.value());
+                cache.save(m_makefile, inputFiles, preprocessor.messages());
+            }
+        }
     } catch (Exception &e) {
         m_errorType = ParserError;
         m_errorString = e.toString();
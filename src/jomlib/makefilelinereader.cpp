@@ -28,25 +28,96 @@
 #include <QTextCodec>
 #include <QDebug>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  include <emmintrin.h>
+#  define JOM_USE_SSE2
+#endif
+
+#if defined(_MSC_VER)
+#  include <intrin.h>
+#endif
+
 namespace NMakeFile {
 
+static const int initialLineBufferSize = 6144;
+
+#ifdef JOM_USE_SSE2
+static inline int countTrailingZeroBits(unsigned int v)
+{
+#if defined(_MSC_VER)
+    unsigned long result;
+    _BitScanForward(&result, v);
+    return static_cast<int>(result);
+#else
+    return __builtin_ctz(v);
+#endif
+}
+#endif
+
+/**
+ * Returns a pointer to the first '\n' or '\r' in the range [p, end) or end,
+ * if there's none. Scans 16 bytes at once where SSE2 is available.
+ */
+static const char *findLineBreak(const char *p, const char *end)
+{
+#ifdef JOM_USE_SSE2
+    const __m128i newLine = _mm_set1_epi8('\n');
+    const __m128i carriageReturn = _mm_set1_epi8('\r');
+    for (; end - p >= 16; p += 16) {
+        const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        const int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, newLine),
+                                                        _mm_cmpeq_epi8(chunk, carriageReturn)));
+        if (mask)
+            return p + countTrailingZeroBits(mask);
+    }
+#endif
+    for (; p != end; ++p)
+        if (*p == '\n' || *p == '\r')
+            return p;
+    return end;
+}
+
+/**
+ * Returns the length of the string without trailing whitespace.
+ * Like the unicode version, the first character is never removed.
+ */
+static int rightTrimmedLength(const char *str, int length)
+{
+    int idx = length - 1;
+    while (idx > 0 && (str[idx] == ' ' || str[idx] == '\t'))
+        --idx;
+    return idx + 1;
+}
+
+static QString decodeLatin1(const char *str, int length)
+{
+    return QString::fromLatin1(str, length);
+}
+
+static QString decodeUtf8(const char *str, int length)
+{
+    return QString::fromUtf8(str, length);
+}
+
 MakefileLineReader::MakefileLineReader(const QString& filename)
-:   m_file(filename),
-    m_nLineBufferSize(m_nInitialLineBufferSize),
+:   m_decode(&decodeLatin1),
+    m_file(filename),
+    m_mappedData(0),
+    m_pos(0),
+    m_end(0),
     m_nLineNumber(0)
 {
-    m_lineBuffer = reinterpret_cast<char*>( malloc(m_nLineBufferSize) );
+    m_lineBuffer.reserve(initialLineBufferSize);
 }
 
 MakefileLineReader::~MakefileLineReader()
 {
     close();
-    free(m_lineBuffer);
 }
 
 bool MakefileLineReader::open()
 {
-    if (!m_file.open(QIODevice::ReadOnly | QIODevice::Text))
+    if (!m_file.open(QIODevice::ReadOnly))
         return false;
 
     // check BOM
@@ -58,13 +129,40 @@ bool MakefileLineReader::open()
     else if (buf.startsWith("\xEF\xBB\xBF"))
         fileEncoding = FCUTF8;
 
-    if (fileEncoding == FCLatin1) {
-        m_readLineImpl = &NMakeFile::MakefileLineReader::readLine_impl_local8bit;
+    const qint64 fileSize = m_file.size();
+    if (fileSize > 0)
+        m_mappedData = m_file.map(0, fileSize);
+    if (m_mappedData) {
+        m_pos = reinterpret_cast<const char *>(m_mappedData);
+        m_end = m_pos + fileSize;
     } else {
-        m_readLineImpl = &NMakeFile::MakefileLineReader::readLine_impl_unicode;
-        m_textStream.setCodec(fileEncoding == FCUTF8 ? "UTF-8" : "UTF-16");
-        m_textStream.setAutoDetectUnicode(false);
-        m_textStream.setDevice(&m_file);
+        // Not mappable (empty file, pipe, ...). Read the whole thing instead.
+        m_fileContent = m_file.readAll();
+        m_pos = m_fileContent.constData();
+        m_end = m_pos + m_fileContent.size();
+    }
+
+    switch (fileEncoding) {
+    case FCLatin1:
+        m_decode = &decodeLatin1;
+        break;
+    case FCUTF8:
+        // All characters with a meaning for the line reader are ASCII.
+        // They never occur within UTF-8 multi-byte sequences.
+        m_decode = &decodeUtf8;
+        m_pos += 3;
+        break;
+    case FCUTF16:
+        // Convert the whole file to UTF-8 once and read it like a UTF-8 file.
+        m_decode = &decodeUtf8;
+        m_fileContent = QTextCodec::codecForName("UTF-16LE")->toUnicode(m_pos + 2, static_cast<int>(m_end - m_pos - 2)).toUtf8();
+        if (m_mappedData) {
+            m_file.unmap(m_mappedData);
+            m_mappedData = 0;
+        }
+        m_pos = m_fileContent.constData();
+        m_end = m_pos + m_fileContent.size();
+        break;
     }
 
     return true;
@@ -72,16 +170,15 @@ bool MakefileLineReader::open()
 
 void MakefileLineReader::close()
 {
+    if (m_mappedData) {
+        m_file.unmap(m_mappedData);
+        m_mappedData = 0;
+    }
+    m_fileContent.clear();
+    m_pos = m_end = 0;
     m_file.close();
 }
 
-void MakefileLineReader::growLineBuffer(size_t nGrow)
-{
-    //fprintf(stderr, "realloc %d -> %d\n", m_nLineBufferSize, m_nLineBufferSize + nGrow);
-    m_nLineBufferSize += nGrow;
-    m_lineBuffer = reinterpret_cast<char*>(realloc(m_lineBuffer, m_nLineBufferSize));
-}
-
 /**
  * This function reads lines from a makefile and
  *    - ignores all lines that start with #
@@ -91,136 +188,116 @@ void MakefileLineReader::growLineBuffer(size_t nGrow)
 QString MakefileLineReader::readLine(bool bInlineFileMode)
 {
     if (bInlineFileMode) {
-        m_nLineNumber++;
-        return QString::fromLatin1(m_file.readLine());
+        const char *line;
+        int length;
+        if (!readPhysicalLine(&line, &length))
+            return QString();
+        QString result = m_decode(line, length);
+        if (m_pos[-1] == '\n')
+            result += QLatin1Char('\n');
+        return result;
     }
 
-    return (this->*m_readLineImpl)();
+    return readLogicalLine();
 }
 
 /**
- * readLine implementation optimized for 8 bit files.
+ * Hands out the next physical line of the file content without its line break.
+ * The returned pointer points directly into the file content, except for lines
+ * that contain stray carriage returns. Those are removed like in text mode
+ * reading does, which requires a copy.
+ * Returns false at the end of the file.
  */
-QString MakefileLineReader::readLine_impl_local8bit()
+bool MakefileLineReader::readPhysicalLine(const char **line, int *length)
 {
-    QString line;
-    bool multiLineAppendix = false;
-    bool endOfLineReached = false;
-    size_t bytesRead;
-    do {
-        do {
-            m_nLineNumber++;
-            const qint64 n = m_file.readLine(m_lineBuffer, m_nLineBufferSize - 1);
-            if (n <= 0)
-                return QString();
-
-            bytesRead = n;
-            while (m_lineBuffer[bytesRead - 1] != '\n') {
-                if (m_file.atEnd()) {
-                    // The file didn't end with a newline.
-                    // Code below relies on having a trailing newline.
-                    // We're imitating it by increasing the string length.
-                    if (bytesRead >= (m_nLineBufferSize - 2))
-                        growLineBuffer(1);
-                    ++bytesRead;
-                    break;
-                }
-
-                growLineBuffer(m_nLineBufferGrowSize);
-                int moreBytesRead = m_file.readLine(m_lineBuffer + bytesRead, m_nLineBufferSize - 1 - bytesRead);
-                if (moreBytesRead <= 0)
-                    break;
-                bytesRead += moreBytesRead;
-            }
-
-        } while (m_lineBuffer[0] == '#');
-        m_lineBuffer[bytesRead] = '\0';
-
-        char* buf = m_lineBuffer;
-        int bufLength = static_cast<int>(bytesRead);
-        if (multiLineAppendix) {
-            // skip leading whitespace characters
-            while (*buf && (*buf == ' ' || *buf == '\t'))
-                buf++;
-            if (buf != m_lineBuffer) {
-                buf--;          // make sure, we keep one whitespace
-                *buf = ' ';     // convert possible tab to space
-                bufLength -= buf - m_lineBuffer;
-            }
-        }
+    m_nLineNumber++;
+    if (m_pos == m_end)
+        return false;
 
-        if (bufLength >= 2 && buf[bufLength - 2] == '\\') {
-            if (bufLength >= 3 && buf[bufLength - 3] == '^') {
-                buf[bufLength - 3] = '\\';      // replace "^\\\n" -> "\\\\\n"
-                bufLength -= 2;                 // remove "\\\n"
-                line.append(QString::fromLatin1(buf, bufLength));
-                endOfLineReached = true;
-            } else {
-                bufLength -= 2; // remove "\\\n"
-                line.append(QString::fromLatin1(buf, bufLength));
-                multiLineAppendix = true;
-            }
-        } else if (bufLength >= 2 && buf[bufLength - 2] == '^') {
-            bufLength--;
-            buf[bufLength-1] = '\n';
-            line.append(QString::fromLatin1(buf, bufLength));
-            multiLineAppendix = true;
-        } else {
-            bufLength--;    // remove trailing \n
-            line.append(QString::fromLatin1(buf, bufLength));
-            endOfLineReached = true;
-        }
-    } while (!endOfLineReached);
+    const char *lineBegin = m_pos;
+    const char *p = findLineBreak(lineBegin, m_end);
+    bool hasStrayCarriageReturn = false;
+    while (p != m_end && *p == '\r') {
+        if (p + 1 != m_end && p[1] == '\n')
+            break;
+        hasStrayCarriageReturn = true;
+        p = findLineBreak(p + 1, m_end);
+    }
 
-    // trim whitespace from the right
-    int idx = line.length() - 1;
-    while (idx > 0 && isSpaceOrTab(line.at(idx)))
-        --idx;
-    line.truncate(idx+1);
+    const char *lineEnd = p;
+    if (p != m_end)
+        p += (*p == '\r') ? 2 : 1;
+    m_pos = p;
 
-    return line;
+    if (hasStrayCarriageReturn) {
+        m_strippedLine.resize(0);
+        for (const char *c = lineBegin; c != lineEnd; ++c)
+            if (*c != '\r')
+                m_strippedLine += *c;
+        if (m_strippedLine.isEmpty() && lineEnd == m_end)
+            return false;   // text mode reading wouldn't see this line at all
+        *line = m_strippedLine.constData();
+        *length = m_strippedLine.length();
+    } else {
+        *line = lineBegin;
+        *length = static_cast<int>(lineEnd - lineBegin);
+    }
+    return true;
 }
 
 /**
- * readLine implementation for unicode files.
- * Much slower than the 8 bit version.
+ * Combines physical lines to a logical line.
+ * Lines without continuation are decoded directly from the file content.
+ * Only continued lines are joined in m_lineBuffer.
  */
-QString MakefileLineReader::readLine_impl_unicode()
+QString MakefileLineReader::readLogicalLine()
 {
-    QString line;
-    bool endOfLineReached = false;
-    bool multilineAppendix = false;
-    do {
-        m_nLineNumber++;
-        QString str = m_textStream.readLine();
-        if (str.isNull())
-            break;
-
-        if (str.startsWith(QLatin1Char('#')))
-            continue;
+    const char *buf;
+    int bufLength;
+    bool multiLineAppendix = false;
+    m_lineBuffer.resize(0);
+    forever {
+        do {
+            if (!readPhysicalLine(&buf, &bufLength))
+                return QString();
+        } while (bufLength > 0 && buf[0] == '#');
 
-        if (multilineAppendix && (str.startsWith(QLatin1Char(' ')) || str.startsWith(QLatin1Char('\t')))) {
-            str = str.trimmed();
-            str.prepend(QLatin1Char(' '));
+        if (multiLineAppendix) {
+            // skip leading whitespace characters, but keep one space
+            int i = 0;
+            while (i < bufLength && (buf[i] == ' ' || buf[i] == '\t'))
+                ++i;
+            if (i > 0) {
+                m_lineBuffer += ' ';
+                buf += i;
+                bufLength -= i;
+            }
         }
 
-        if (str.endsWith(QLatin1String("^\\"))) {
-            str.remove(str.length() - 2, 1);
-            endOfLineReached = true;
-        } else if (str.endsWith(QLatin1Char('\\'))) {
-            str.chop(1);
-            multilineAppendix = true;
-        } else if (str.endsWith(QLatin1Char('^'))) {
-            str.chop(1);
-            str.append(QLatin1Char('\n'));
-            multilineAppendix = true;
+        if (bufLength >= 1 && buf[bufLength - 1] == '\\') {
+            if (bufLength >= 2 && buf[bufLength - 2] == '^') {
+                // "^\\" is an escaped backslash at the end of the line
+                m_lineBuffer.append(buf, bufLength - 2);
+                m_lineBuffer += '\\';
+                break;
+            }
+            m_lineBuffer.append(buf, bufLength - 1);
+            multiLineAppendix = true;
+        } else if (bufLength >= 1 && buf[bufLength - 1] == '^') {
+            m_lineBuffer.append(buf, bufLength - 1);
+            m_lineBuffer += '\n';
+            multiLineAppendix = true;
+        } else if (!multiLineAppendix) {
+            // common case: a single physical line
+            return m_decode(buf, rightTrimmedLength(buf, bufLength));
         } else {
-            endOfLineReached = true;
+            m_lineBuffer.append(buf, bufLength);
+            break;
         }
+    }
 
-        line.append(str);
-    } while (!endOfLineReached);
-    return line;
+    return m_decode(m_lineBuffer.constData(),
+                    rightTrimmedLength(m_lineBuffer.constData(), m_lineBuffer.length()));
 }
 
 } // namespace NMakeFile
@@ -26,8 +26,8 @@
 #ifndef MAKEFILELINEREADER_H
 #define MAKEFILELINEREADER_H
 
+#include <QtCore/QByteArray>
 #include <QtCore/QFile>
-#include <QtCore/QTextStream>
 
 namespace NMakeFile {
 
@@ -43,20 +43,20 @@ public:
     uint lineNumber() const { return m_nLineNumber; }
 
 private:
-    void growLineBuffer(size_t nGrow);
+    bool readPhysicalLine(const char **line, int *length);
+    QString readLogicalLine();
 
-    typedef QString (MakefileLineReader::*ReadLineImpl)();
-    ReadLineImpl m_readLineImpl;
-    QString readLine_impl_local8bit();
-    QString readLine_impl_unicode();
+    typedef QString (*DecodeFunction)(const char *str, int length);
+    DecodeFunction m_decode;
 
 private:
     QFile m_file;
-    QTextStream m_textStream;
-    static const size_t m_nInitialLineBufferSize = 6144;
-    static const size_t m_nLineBufferGrowSize = 1024;
-    size_t m_nLineBufferSize;
-    char *m_lineBuffer;
+    uchar *m_mappedData;
+    QByteArray m_fileContent;
+    const char *m_pos;
+    const char *m_end;
+    QByteArray m_lineBuffer;
+    QByteArray m_strippedLine;
     uint m_nLineNumber;
 };
 
@@ -0,0 +1,292 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of jom.
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+
+#include "makefiletokenizer.h"
+#include "helperfunctions.h"
+
+#include <QtCore/QByteArray>
+
+namespace NMakeFile {
+
+namespace {
+
+struct Keyword
+{
+    const char *name;
+    int id;
+};
+
+// The tables must be sorted by name.
+const Keyword directiveKeywords[] = {
+    { "CMDSWITCHES", MakefileTokenizer::DirectiveCmdSwitches },
+    { "ELSE",        MakefileTokenizer::DirectiveElse },
+    { "ELSEIF",      MakefileTokenizer::DirectiveElseIf },
+    { "ELSEIFDEF",   MakefileTokenizer::DirectiveElseIfDef },
+    { "ELSEIFNDEF",  MakefileTokenizer::DirectiveElseIfNDef },
+    { "ENDIF",       MakefileTokenizer::DirectiveEndIf },
+    { "ERROR",       MakefileTokenizer::DirectiveError },
+    { "IF",          MakefileTokenizer::DirectiveIf },
+    { "IFDEF",       MakefileTokenizer::DirectiveIfDef },
+    { "IFNDEF",      MakefileTokenizer::DirectiveIfNDef },
+    { "INCLUDE",     MakefileTokenizer::DirectiveInclude },
+    { "MESSAGE",     MakefileTokenizer::DirectiveMessage },
+    { "UNDEF",       MakefileTokenizer::DirectiveUndef }
+};
+
+const Keyword dotDirectiveKeywords[] = {
+    { "IGNORE",   MakefileTokenizer::DotDirectiveIgnore },
+    { "PRECIOUS", MakefileTokenizer::DotDirectivePrecious },
+    { "RESTAT",   MakefileTokenizer::DotDirectiveRestat },
+    { "SILENT",   MakefileTokenizer::DotDirectiveSilent },
+    { "SUFFIXES", MakefileTokenizer::DotDirectiveSuffixes }
+};
+
+/**
+ * Looks up str in a sorted keyword table and returns the keyword's id or 0.
+ * If caseSensitive is false, str is compared in upper case.
+ */
+template <size_t N>
+int lookupKeyword(const Keyword (&table)[N], const QChar *str, int length, bool caseSensitive)
+{
+    char buf[16];
+    if (length <= 0 || length >= int(sizeof(buf)))
+        return 0;
+    for (int i = 0; i < length; ++i) {
+        ushort ch = str[i].unicode();
+        if (!caseSensitive && ch >= 'a' && ch <= 'z')
+            ch -= 'a' - 'A';
+        if (ch < 'A' || ch > 'Z')
+            return 0;
+        buf[i] = char(ch);
+    }
+    buf[length] = '\0';
+
+    int low = 0;
+    int high = int(N) - 1;
+    while (low <= high) {
+        const int mid = (low + high) / 2;
+        const int cmp = qstrcmp(table[mid].name, buf);
+        if (cmp == 0)
+            return table[mid].id;
+        if (cmp < 0)
+            low = mid + 1;
+        else
+            high = mid - 1;
+    }
+    return 0;
+}
+
+/**
+ * Returns the position of the '.' of the extension that ends at end or -1.
+ */
+int extensionStart(const QString &line, int end)
+{
+    int i = end;
+    while (i > 0 && MakefileTokenizer::isWordCharacter(line.at(i - 1)))
+        --i;
+    if (i == end || i == 0 || line.at(i - 1) != QLatin1Char('.'))
+        return -1;
+    return i - 1;
+}
+
+/**
+ * Matches the part "{frompath}.fromext" that ends at end.
+ */
+bool matchInferenceRuleSource(const QString &line, int end, MakefileTokenizer::InferenceRuleHeader *header)
+{
+    const int extStart = extensionStart(line, end);
+    if (extStart < 0)
+        return false;
+    if (extStart > 0) {
+        if (extStart < 2 || line.at(0) != QLatin1Char('{')
+                || line.at(extStart - 1) != QLatin1Char('}')) {
+            return false;
+        }
+        header->fromPath = line.mid(1, extStart - 2);
+    } else {
+        header->fromPath.clear();
+    }
+    header->fromExtension = line.mid(extStart, end - extStart);
+    return true;
+}
+
+} // namespace
+
+/**
+ * Returns false, if line cannot be a preprocessing directive, even after
+ * expanding the macros in it. This is the case for all lines that don't
+ * start with '!', "include" or a macro invocation.
+ */
+bool MakefileTokenizer::mayBePreprocessingDirective(const QString &line)
+{
+    if (line.isEmpty())
+        return false;
+    const QChar ch = line.at(0);
+    return ch == QLatin1Char('!') || ch == QLatin1Char('$')
+            || ch == QLatin1Char('i') || ch == QLatin1Char('I');
+}
+
+/**
+ * Classifies a macro expanded line as preprocessing directive.
+ * The value is the rest of the line after the directive.
+ */
+MakefileTokenizer::Directive MakefileTokenizer::preprocessingDirective(const QString &line,
+                                                                       QString *value)
+{
+    const int length = line.length();
+    if (length == 0)
+        return NoDirective;
+
+    if (line.at(0) != QLatin1Char('!')) {
+        // old style include directive: "include filename"
+        if (length > 8 && isSpaceOrTab(line.at(7))
+                && line.startsWith(QLatin1String("include"), Qt::CaseInsensitive)) {
+            if (value)
+                *value = line.mid(8);
+            return DirectiveInclude;
+        }
+        return NoDirective;
+    }
+
+    int i = 1;
+    while (i < length && line.at(i).isSpace())
+        ++i;
+    const int nameStart = i;
+    while (i < length && !line.at(i).isSpace())
+        ++i;
+    if (i == nameStart)
+        return NoDirective;
+
+    if (value)
+        *value = line.mid(i).trimmed();
+    const int id = lookupKeyword(directiveKeywords, line.constData() + nameStart, i - nameStart,
+                                 false);
+    return id ? Directive(id) : UnknownDirective;
+}
+
+bool MakefileTokenizer::isConditionalStart(Directive directive)
+{
+    return directive == DirectiveIf || directive == DirectiveIfDef
+            || directive == DirectiveIfNDef;
+}
+
+bool MakefileTokenizer::isConditionalAlternative(Directive directive)
+{
+    return directive == DirectiveElse || directive == DirectiveElseIf
+            || directive == DirectiveElseIfDef || directive == DirectiveElseIfNDef;
+}
+
+/**
+ * Returns true, if the line starts like a macro definition.
+ * The caller must look for the equals sign.
+ */
+bool MakefileTokenizer::mayBeMacroDefinition(const QString &line)
+{
+    if (line.isEmpty())
+        return false;
+    const ushort ch = line.at(0).unicode();
+    return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9')
+            || ch == '_' || ch == '$';
+}
+
+/**
+ * Returns true, if the macros in line must be expanded to tell whether the line is empty,
+ * a dot directive or an inference rule. Macro expansion doesn't change the characters
+ * in front of the first macro invocation.
+ */
+bool MakefileTokenizer::classificationDependsOnMacros(const QString &line)
+{
+    if (line.isEmpty())
+        return false;
+    const QChar ch = line.at(0);
+    if (ch != QLatin1Char('$') && ch != QLatin1Char('.') && ch != QLatin1Char('{') && !ch.isSpace())
+        return false;
+    return line.contains(QLatin1Char('$'));
+}
+
+/**
+ * Classifies a line like ".SUFFIXES: .c .cpp".
+ * The value is the rest of the line after the colon.
+ */
+MakefileTokenizer::DotDirective MakefileTokenizer::dotDirective(const QString &line, QString *value)
+{
+    const int length = line.length();
+    if (length < 2 || line.at(0) != QLatin1Char('.'))
+        return NoDotDirective;
+
+    int i = 1;
+    while (i < length && line.at(i) >= QLatin1Char('A') && line.at(i) <= QLatin1Char('Z'))
+        ++i;
+    const int id = lookupKeyword(dotDirectiveKeywords, line.constData() + 1, i - 1, true);
+    if (!id)
+        return NoDotDirective;
+
+    while (i < length && line.at(i).isSpace())
+        ++i;
+    if (i == length || line.at(i) != QLatin1Char(':'))
+        return NoDotDirective;
+
+    if (value)
+        *value = line.mid(i + 1);
+    return DotDirective(id);
+}
+
+/**
+ * Matches a line of the form "{frompath}.fromext{topath}.toext:" with optional paths.
+ * A double colon denotes a batch mode rule.
+ */
+bool MakefileTokenizer::inferenceRule(const QString &line, InferenceRuleHeader *header)
+{
+    int end = line.length();
+    if (end == 0 || line.at(end - 1) != QLatin1Char(':'))
+        return false;
+    --end;
+    header->batchMode = end > 0 && line.at(end - 1) == QLatin1Char(':');
+    if (header->batchMode)
+        --end;
+
+    const int toExtStart = extensionStart(line, end);
+    if (toExtStart < 0)
+        return false;
+    header->toExtension = line.mid(toExtStart, end - toExtStart);
+
+    if (toExtStart > 0 && line.at(toExtStart - 1) == QLatin1Char('}')) {
+        // Find the opening brace of the target path.
+        // Prefer the rightmost one that leaves a valid source part.
+        for (int i = toExtStart - 2; i >= 0; --i) {
+            if (line.at(i) == QLatin1Char('{') && matchInferenceRuleSource(line, i, header)) {
+                header->toPath = line.mid(i + 1, toExtStart - i - 2);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    header->toPath.clear();
+    return matchInferenceRuleSource(line, toExtStart, header);
+}
+
+} // namespace NMakeFile
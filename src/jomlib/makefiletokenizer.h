@@ -0,0 +1,100 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of jom.
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+
+#ifndef MAKEFILETOKENIZER_H
+#define MAKEFILETOKENIZER_H
+
+#include <QtCore/QString>
+
+namespace NMakeFile {
+
+/**
+ * Classifies makefile lines by their first characters.
+ *
+ * Keywords are looked up in static tables. None of the functions expands macros.
+ * The caller decides with classificationDependsOnMacros and
+ * mayBePreprocessingDirective, whether a line must be expanded first.
+ */
+class MakefileTokenizer
+{
+public:
+    enum Directive
+    {
+        NoDirective,
+        UnknownDirective,
+        DirectiveCmdSwitches,
+        DirectiveElse,
+        DirectiveElseIf,
+        DirectiveElseIfDef,
+        DirectiveElseIfNDef,
+        DirectiveEndIf,
+        DirectiveError,
+        DirectiveIf,
+        DirectiveIfDef,
+        DirectiveIfNDef,
+        DirectiveInclude,
+        DirectiveMessage,
+        DirectiveUndef
+    };
+
+    enum DotDirective
+    {
+        NoDotDirective,
+        DotDirectiveIgnore,
+        DotDirectivePrecious,
+        DotDirectiveRestat,
+        DotDirectiveSilent,
+        DotDirectiveSuffixes
+    };
+
+    struct InferenceRuleHeader
+    {
+        QString fromPath;
+        QString fromExtension;
+        QString toPath;
+        QString toExtension;
+        bool batchMode;
+    };
+
+    static bool mayBePreprocessingDirective(const QString &line);
+    static Directive preprocessingDirective(const QString &line, QString *value);
+    static bool isConditionalStart(Directive directive);
+    static bool isConditionalAlternative(Directive directive);
+
+    static bool mayBeMacroDefinition(const QString &line);
+    static bool classificationDependsOnMacros(const QString &line);
+    static DotDirective dotDirective(const QString &line, QString *value);
+    static bool inferenceRule(const QString &line, InferenceRuleHeader *header);
+
+    static bool isWordCharacter(const QChar &ch)
+    {
+        return ch.isLetterOrNumber() || ch.isMark() || ch == QLatin1Char('_');
+    }
+};
+
+} // namespace NMakeFile
+
+#endif // MAKEFILETOKENIZER_H
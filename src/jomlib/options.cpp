@@ -59,9 +59,14 @@ Options::Options()
     suppressExecutedCommandsDisplay(false),
     printWorkingDir(false),
     batchModeEnabled(true),
+    batchModeWindow(50),
     dumpInlineFiles(false),
     dumpDependencyGraph(false),
     dumpDependencyGraphDot(false),
+    scheduleCriticalPathFirst(false),
+    buildTargetsSequentially(false),
+    compareContentHashes(false),
+    useMakefileCache(true),
     displayMakeInformation(false),
     showUsageAndExit(false),
     displayBuildInfo(false),
@@ -193,6 +198,34 @@ bool Options::handleCommandLineOption(const QStringList &originalArguments, QStr
                 arg.remove(0, 9);
                 dumpDependencyGraph = true;
                 showLogo = false;
+            } else if (upperArg.startsWith(QLatin1String("CONTENTHASH"))) {
+                arg.remove(0, 11);
+                compareContentHashes = true;
+            } else if (upperArg.startsWith(QLatin1String("CRITICALPATH"))) {
+                arg.remove(0, 12);
+                scheduleCriticalPathFirst = true;
+            } else if (upperArg.startsWith(QLatin1String("BATCHWINDOW"))) {
+                QString msecsStr = arg.mid(11);
+                arg.clear();
+                if (msecsStr.isEmpty()) {
+                    if (arguments.isEmpty()) {
+                        fputs("Error: no time span specified for option /BATCHWINDOW\n", stderr);
+                        return false;
+                    }
+                    msecsStr = arguments.takeFirst();
+                }
+                bool ok;
+                batchModeWindow = msecsStr.toUInt(&ok);
+                if (!ok) {
+                    fputs("Error: option /BATCHWINDOW expects a numerical argument\n", stderr);
+                    return false;
+                }
+            } else if (upperArg.startsWith(QLatin1String("NOMAKEFILECACHE"))) {
+                arg.remove(0, 15);
+                useMakefileCache = false;
+            } else if (upperArg.startsWith(QLatin1String("SEQUENTIALTARGETS"))) {
+                arg.remove(0, 17);
+                buildTargetsSequentially = true;
             } else if (upperArg.startsWith(QLatin1String("DEBUG"))) {
                 arg.remove(0, 5);
                 debugMode = true;
@@ -56,9 +56,14 @@ public:
     bool suppressExecutedCommandsDisplay;
     bool printWorkingDir;
     bool batchModeEnabled;
+    int batchModeWindow;        // milliseconds to wait for more batch mode targets
     bool dumpInlineFiles;
     bool dumpDependencyGraph;
     bool dumpDependencyGraphDot;
+    bool scheduleCriticalPathFirst;
+    bool buildTargetsSequentially;
+    bool compareContentHashes;
+    bool useMakefileCache;
     bool displayMakeInformation;
     bool showUsageAndExit;
     bool displayBuildInfo;
@@ -28,10 +28,11 @@
 #include "options.h"
 #include "exception.h"
 #include "helperfunctions.h"
+#include "fastfileinfo.h"
 
 #include <QDebug>
 #include <QDir>
-#include <QDirIterator>
+#include <QVector>
 
 #include <limits>
 
@@ -40,9 +41,6 @@ namespace NMakeFile {
 Parser::Parser()
 :   m_preprocessor(0)
 {
-    m_rexDotDirective.setPattern(QLatin1String("^\\.(IGNORE|PRECIOUS|SILENT|SUFFIXES)\\s*:(.*)"));
-    m_rexInferenceRule.setPattern(QLatin1String("^(\\{.*\\})?(\\.\\w+)(\\{.*\\})?(\\.\\w+)(:{1,2})"));
-    m_rexSingleWhiteSpace.setPattern(QLatin1String("\\s"));
 }
 
 Parser::~Parser()
@@ -78,22 +76,31 @@ void Parser::apply(Preprocessor* pp,
                << QLatin1String(".rc");
     m_syncPoints.clear();
     m_ruleIdxByToExtension.clear();
+    m_listedDirectories.clear();
     int dbSeparatorPos, dbSeparatorLength, dbCommandSeparatorPos;
 
+    MakefileTokenizer::DotDirective dotDirective;
+    MakefileTokenizer::InferenceRuleHeader inferenceRuleHeader;
+
     try {
         readLine();
         while (!m_line.isNull()) {
-            QString expandedLine = m_preprocessor->macroTable()->expandMacros(m_line);
+            // Description blocks expand their parts themselves.
+            // Only expand here, if the classification of the line depends on it.
+            const QString expandedLine = MakefileTokenizer::classificationDependsOnMacros(m_line)
+                    ? m_preprocessor->macroTable()->expandMacros(m_line)
+                    : m_line;
             if (isEmptyLine(expandedLine)) {
                 readLine();
-            } else if (isDotDirective(expandedLine)) {
+            } else if ((dotDirective = MakefileTokenizer::dotDirective(expandedLine, 0))
+                       != MakefileTokenizer::NoDotDirective) {
                 m_line = expandedLine;
                 Preprocessor::removeInlineComments(m_line);
-                parseDotDirective();
-            } else if (isInferenceRule(expandedLine)) {
+                parseDotDirective(dotDirective);
+            } else if (MakefileTokenizer::inferenceRule(expandedLine, &inferenceRuleHeader)) {
                 m_line = expandedLine;
                 Preprocessor::removeInlineComments(m_line);
-                parseInferenceRule();
+                parseInferenceRule(inferenceRuleHeader);
             } else if (isDescriptionBlock(dbSeparatorPos, dbSeparatorLength, dbCommandSeparatorPos)) {
                 parseDescriptionBlock(dbSeparatorPos, dbSeparatorLength, dbCommandSeparatorPos);
             } else {
@@ -135,6 +142,7 @@ void Parser::apply(Preprocessor* pp,
             break;
         target->m_dependents += it.value();
         target->m_dependents.removeDuplicates();
+        target->invalidateDependentTargets();
     }
 
     // build rule suffix cache
@@ -271,16 +279,6 @@ bool Parser::isDescriptionBlock(int& separatorPos, int& separatorLength, int& co
     return true;
 }
 
-bool Parser::isInferenceRule(const QString& line)
-{
-    return m_rexInferenceRule.exactMatch(line);
-}
-
-bool Parser::isDotDirective(const QString& line)
-{
-    return m_rexDotDirective.exactMatch(line);
-}
-
 DescriptionBlock* Parser::createTarget(const QString& targetName)
 {
     DescriptionBlock* target = new DescriptionBlock(m_makefile);
@@ -351,31 +349,83 @@ static bool containsWildcard(const QString &str)
     return false;
 }
 
-static QStringList expandWildcards(const QString &dirPath, const QStringList &lst)
+/**
+ * Replaces the dependents that contain wildcards by the matching files.
+ *
+ * The directory listings come from the FastFileInfo cache. Each directory is read
+ * once per jom run, no matter how many description blocks refer to it, and the
+ * time stamps of the matching files are cached on the way. The directories of one
+ * dependency line are read concurrently.
+ */
+static QStringList expandWildcards(const QString &dirPath, const QStringList &lst,
+                                   QHash<QString, FastFileInfo> *listedDirectories)
 {
+    struct WildcardPattern
+    {
+        QString subDirectory;       // as written in the makefile, relative to dirPath
+        QString listingPath;        // the directory to search
+        QString fileNamePattern;
+    };
+
+    QVector<WildcardPattern> patterns(lst.count());
+    QStringList listingPaths;
+    bool isMakefileDirCurrent = false;
+    bool isMakefileDirCurrentKnown = false;
+    for (int i = 0; i < lst.count(); ++i) {
+        if (!containsWildcard(lst.at(i)))
+            continue;
+
+        if (!isMakefileDirCurrentKnown) {
+            isMakefileDirCurrent = (QDir(dirPath) == QDir::current());
+            isMakefileDirCurrentKnown = true;
+        }
+
+        WildcardPattern &pattern = patterns[i];
+        pattern.fileNamePattern = QDir::fromNativeSeparators(lst.at(i));
+        const int idx = pattern.fileNamePattern.lastIndexOf(QLatin1Char('/'));
+        if (idx != -1) {
+            pattern.subDirectory = pattern.fileNamePattern.left(idx);
+            pattern.fileNamePattern.remove(0, idx + 1);
+        }
+
+        // Relative paths share the cached directories with the FastFileInfo
+        // lookups of the dependents, which are relative to the current directory.
+        if (QDir::isAbsolutePath(pattern.subDirectory))
+            pattern.listingPath = pattern.subDirectory;
+        else if (isMakefileDirCurrent)
+            pattern.listingPath = pattern.subDirectory;
+        else if (pattern.subDirectory.isEmpty())
+            pattern.listingPath = dirPath;
+        else
+            pattern.listingPath = dirPath + QLatin1Char('/') + pattern.subDirectory;
+        listingPaths.append(pattern.listingPath);
+    }
+
+    if (listingPaths.isEmpty())
+        return lst;
+    foreach (const QString &listingPath, listingPaths) {
+        const QString listedPath = listingPath.isEmpty() ? QStringLiteral(".") : listingPath;
+        if (!listedDirectories->contains(listedPath)) {
+            listedDirectories->insert(listedPath,
+                                      FastFileInfo(listedPath, FastFileInfo::BypassCache));
+        }
+    }
+    FastFileInfo::readDirectories(listingPaths);
+
     QStringList result;
-    foreach (QString str, lst) {
-        if (containsWildcard(str)) {
-            QString path = dirPath;
-            str = QDir::fromNativeSeparators(str);
-            int idx = str.lastIndexOf(QLatin1Char('/'));
-            if (idx != -1) {
-                path += QLatin1Char('/') + str.left(idx);
-                str.remove(0, idx + 1);
-            }
+    for (int i = 0; i < lst.count(); ++i) {
+        const WildcardPattern &pattern = patterns.at(i);
+        if (pattern.fileNamePattern.isEmpty()) {
+            result.append(lst.at(i));
+            continue;
+        }
 
-            QDirIterator dit(path, QStringList(str));
-            while (dit.hasNext()) {
-                QString filePath = dit.next();
-                if (filePath.startsWith(dirPath, Qt::CaseInsensitive)) {
-                    filePath.remove(0, dirPath.length());
-                    if (filePath.startsWith(QLatin1Char('/')))
-                       filePath.remove(0, 1);
-                }
-                result.append(QDir::toNativeSeparators(filePath));
-            }
-        } else {
-            result.append(str);
+        const QString prefix = pattern.subDirectory.isEmpty()
+                ? QString() : QDir::toNativeSeparators(pattern.subDirectory) + QDir::separator();
+        foreach (const QString &fileName,
+                 FastFileInfo::findFiles(pattern.listingPath, pattern.fileNamePattern))
+        {
+            result.append(prefix + fileName);
         }
     }
     return result;
@@ -412,7 +462,7 @@ void Parser::parseDescriptionBlock(int separatorPos, int separatorLength, int co
 
     const QStringList targets = splitTargetNames(target);
     QStringList dependents = splitTargetNames(value);
-    dependents = expandWildcards(m_makefile->dirPath(), dependents);
+    dependents = expandWildcards(m_makefile->dirPath(), dependents, &m_listedDirectories);
 
     // handle the special .SYNC dependents
     {
@@ -539,7 +589,7 @@ void Parser::parseInlineFiles(Command& cmd, bool inferenceRule)
         readLine();
         while (!m_line.isNull()) {
             if (m_line.startsWith(QLatin1String("<<"))) {
-                QStringList options = m_line.right(m_line.length() - 2).split(m_rexSingleWhiteSpace);
+                QStringList options = m_line.mid(2).simplified().split(QLatin1Char(' '));
                 if (options.contains(QLatin1String("KEEP")))
                     inlineFile->m_keep = true;
                 if (options.contains(QLatin1String("UNICODE")))
@@ -567,35 +617,24 @@ void Parser::parseInlineFiles(Command& cmd, bool inferenceRule)
     m_preprocessor->setInlineFileModeEnabled(false);
 }
 
-void Parser::parseInferenceRule()
+void Parser::parseInferenceRule(const MakefileTokenizer::InferenceRuleHeader &header)
 {
-    QString fromPath = m_rexInferenceRule.cap(1);
-    QString fromExt  = m_rexInferenceRule.cap(2);
-    QString toPath   = m_rexInferenceRule.cap(3);
-    QString toExt    = m_rexInferenceRule.cap(4);
-    bool batchMode   = m_rexInferenceRule.cap(5).length() > 1;
-
-    if (fromPath.length() >= 2)
-        fromPath = fromPath.mid(1, fromPath.length() - 2);
-    if (toPath.length() >= 2)
-        toPath = toPath.mid(1, toPath.length() - 2);
+    QString fromPath = header.fromPath;
+    QString toPath = header.toPath;
     if (fromPath.isEmpty())
         fromPath = QLatin1String(".");
     if (toPath.isEmpty())
         toPath = QLatin1String(".");
 
-    //qDebug() << fromPath << fromExt
-    //         << toPath << toExt << batchMode;
-
     removeDirSeparatorAtEnd(fromPath);
     removeDirSeparatorAtEnd(toPath);
 
     InferenceRule *rule = new InferenceRule();
-    rule->m_batchMode = batchMode;
+    rule->m_batchMode = header.batchMode;
     rule->m_fromSearchPath = fromPath;
-    rule->m_fromExtension = fromExt;
+    rule->m_fromExtension = header.fromExtension;
     rule->m_toSearchPath = toPath;
-    rule->m_toExtension = toExt;
+    rule->m_toExtension = header.toExtension;
 
     readLine();
     while (parseCommand(rule->m_commands, true))
@@ -604,50 +643,92 @@ void Parser::parseInferenceRule()
     m_makefile->addInferenceRule(rule);
 }
 
-void Parser::parseDotDirective()
+void Parser::parseDotDirective(MakefileTokenizer::DotDirective directive)
 {
-    QString directive = m_rexDotDirective.cap(1);
-    QString value = m_rexDotDirective.cap(2);
-    //qDebug() << m_rexDotDirective.cap(1) << m_rexDotDirective.cap(2);
+    // The value is taken from the line without comments.
+    QString value;
+    MakefileTokenizer::dotDirective(m_line, &value);
+    const QStringList splitvalues = value.simplified().split(QLatin1Char(' '), QString::SkipEmptyParts);
 
-    if (directive == QLatin1String("SUFFIXES")) {
-        QStringList splitvalues = value.simplified().split(m_rexSingleWhiteSpace, QString::SkipEmptyParts);
-        //qDebug() << "splitvalues" << splitvalues;
+    switch (directive) {
+    case MakefileTokenizer::DotDirectiveSuffixes:
         if (splitvalues.isEmpty())
             m_suffixes.clear();
         else
             m_suffixes.append(splitvalues);
-        //qDebug() << ".SUFFIXES" << m_suffixes;
-    } else if (directive == QLatin1String("IGNORE")) {
+        break;
+    case MakefileTokenizer::DotDirectiveIgnore:
         m_ignoreExitCodes = true;
-    } else if (directive == QLatin1String("PRECIOUS")) {
-        const QStringList& splitvalues = value.split(m_rexSingleWhiteSpace);
-        foreach (QString str, splitvalues)
-            if (!str.isEmpty())
-                m_makefile->addPreciousTarget(str);
-    } else if (directive == QLatin1String("SILENT")) {
+        break;
+    case MakefileTokenizer::DotDirectivePrecious:
+        foreach (const QString &str, splitvalues)
+            m_makefile->addPreciousTarget(str);
+        break;
+    case MakefileTokenizer::DotDirectiveRestat:
+        foreach (const QString &str, splitvalues)
+            m_makefile->addRestatName(str);
+        break;
+    case MakefileTokenizer::DotDirectiveSilent:
         m_silentCommands = true;
+        break;
+    case MakefileTokenizer::NoDotDirective:
+        break;
     }
 
     readLine();
 }
 
-void Parser::checkForCycles(DescriptionBlock* target)
+/**
+ * Checks the targets reachable from root for cycles.
+ *
+ * This is an iterative depth-first search that visits each target once. Targets on the
+ * current path are in the CCSVisiting state. Targets whose dependents have been fully
+ * explored are in the CCSDone state and are skipped by later searches.
+ */
+void Parser::checkForCycles(DescriptionBlock* root)
 {
-    if (!target)
+    if (!root || root->m_cycleCheckState == DescriptionBlock::CCSDone)
         return;
 
-    if (target->m_bVisitedByCycleCheck) {
-        QString msg = QLatin1String("cycle in targets detected: %1");
-        throw Exception(msg.arg(target->targetName()));
-    }
+    struct Frame
+    {
+        DescriptionBlock *target;
+        int dependentIdx;
+    };
+
+    QVector<Frame> path;
+    root->m_cycleCheckState = DescriptionBlock::CCSVisiting;
+    Frame rootFrame = { root, root->m_dependents.count() };
+    path.append(rootFrame);
+    while (!path.isEmpty()) {
+        Frame &frame = path.last();
+        if (frame.dependentIdx == 0) {
+            frame.target->m_cycleCheckState = DescriptionBlock::CCSDone;
+            path.removeLast();
+            continue;
+        }
+
+        DescriptionBlock *const dep = frame.target->dependentTargets().at(--frame.dependentIdx);
+        if (!dep || dep->m_cycleCheckState == DescriptionBlock::CCSDone)
+            continue;
+
+        if (dep->m_cycleCheckState == DescriptionBlock::CCSVisiting) {
+            QStringList cycle;
+            bool inCycle = false;
+            foreach (const Frame &f, path) {
+                inCycle = inCycle || f.target == dep;
+                if (inCycle)
+                    cycle.append(f.target->targetName());
+            }
+            cycle.append(dep->targetName());
+            QString msg = QLatin1String("cycle in targets detected: %1");
+            throw Exception(msg.arg(cycle.join(QLatin1String(" -> "))));
+        }
 
-    target->m_bVisitedByCycleCheck = true;
-    for (int i = target->m_dependents.count(); --i >= 0;) {
-        DescriptionBlock *const dep = m_makefile->target(target->m_dependents.at(i));
-        checkForCycles(dep);
+        dep->m_cycleCheckState = DescriptionBlock::CCSVisiting;
+        Frame depFrame = { dep, dep->m_dependents.count() };
+        path.append(depFrame);
     }
-    target->m_bVisitedByCycleCheck = false;
 }
 
 QVector<InferenceRule*> Parser::findRulesByTargetName(const QString& targetFilePath)
@@ -679,24 +760,42 @@ QVector<InferenceRule*> Parser::findRulesByTargetName(const QString& targetFileP
     return rules;
 }
 
-void Parser::preselectInferenceRules(DescriptionBlock *target)
+/**
+ * Assigns the candidate inference rules to all targets reachable from root
+ * that have no commands. Each target is visited once.
+ */
+void Parser::preselectInferenceRules(DescriptionBlock *root)
 {
-    if (target->m_commands.isEmpty()) {
-        QVector<InferenceRule *> rules = findRulesByTargetName(target->targetName());
-        if (!rules.isEmpty())
-            target->m_inferenceRules = rules;
-    }
-    foreach (const QString &dependentName, target->m_dependents) {
-        DescriptionBlock *dependent = m_makefile->target(dependentName);
-        if (dependent) {
-            preselectInferenceRules(dependent);
-        } else {
-            QString dependentFileName = dependentName;
-            removeDoubleQuotes(dependentFileName);
-            QVector<InferenceRule *> rules = findRulesByTargetName(dependentFileName);
-            if (!rules.isEmpty()) {
-                dependent = createTarget(dependentFileName);
-                dependent->m_inferenceRules = rules;
+    if (!root || root->m_bInferenceRulesPreselected)
+        return;
+
+    QVector<DescriptionBlock *> stack;
+    root->m_bInferenceRulesPreselected = true;
+    stack.append(root);
+    while (!stack.isEmpty()) {
+        DescriptionBlock *target = stack.takeLast();
+        if (target->m_commands.isEmpty()) {
+            QVector<InferenceRule *> rules = findRulesByTargetName(target->targetName());
+            if (!rules.isEmpty())
+                target->m_inferenceRules = rules;
+        }
+        const QVector<DescriptionBlock *> dependentTargets = target->dependentTargets();
+        for (int i = 0; i < dependentTargets.count(); ++i) {
+            DescriptionBlock *dependent = dependentTargets.at(i);
+            if (dependent) {
+                if (!dependent->m_bInferenceRulesPreselected) {
+                    dependent->m_bInferenceRulesPreselected = true;
+                    stack.append(dependent);
+                }
+            } else {
+                QString dependentFileName = target->m_dependents.at(i);
+                removeDoubleQuotes(dependentFileName);
+                QVector<InferenceRule *> rules = findRulesByTargetName(dependentFileName);
+                if (!rules.isEmpty()) {
+                    dependent = createTarget(dependentFileName);
+                    dependent->m_inferenceRules = rules;
+                    dependent->m_bInferenceRulesPreselected = true;
+                }
             }
         }
     }
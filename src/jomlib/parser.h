@@ -26,13 +26,14 @@
 #ifndef PARSER_H
 #define PARSER_H
 
-#include <QRegExp>
 #include <QHash>
 #include <QVector>
 #include <QStack>
 #include <QStringList>
 
+#include "fastfileinfo.h"
 #include "makefile.h"
+#include "makefiletokenizer.h"
 
 namespace NMakeFile {
 
@@ -50,22 +51,26 @@ public:
                const QStringList& activeTargets = QStringList());
     MacroTable* macroTable();
 
+    /**
+     * Returns the directories that were searched for wildcard matches,
+     * with their time stamps from before they were searched.
+     */
+    const QHash<QString, FastFileInfo> &listedDirectories() const { return m_listedDirectories; }
+
 private:
     void readLine();
     bool isEmptyLine(const QString& line);
     bool isDescriptionBlock(int& separatorPos, int& separatorLength, int& commandSeparatorPos);
-    bool isInferenceRule(const QString& line);
-    bool isDotDirective(const QString& line);
     DescriptionBlock* createTarget(const QString& targetName);
     void parseDescriptionBlock(int separatorPos, int separatorLength, int commandSeparatorPos);
-    void parseInferenceRule();
-    void parseDotDirective();
+    void parseInferenceRule(const MakefileTokenizer::InferenceRuleHeader &header);
+    void parseDotDirective(MakefileTokenizer::DotDirective directive);
     bool parseCommand(QList<Command>& commands, bool inferenceRule);
     void parseCommandLine(const QString& cmdLine, QList<Command>& commands, bool inferenceRule);
     void parseInlineFiles(Command& cmd, bool inferenceRule);
-    void checkForCycles(DescriptionBlock* target);
+    void checkForCycles(DescriptionBlock* root);
     QVector<InferenceRule*> findRulesByTargetName(const QString& targetFilePath);
-    void preselectInferenceRules(DescriptionBlock *target);
+    void preselectInferenceRules(DescriptionBlock *root);
     void error(const QString& msg);
 
 private:
@@ -74,15 +79,12 @@ private:
     bool                        m_silentCommands;
     bool                        m_ignoreExitCodes;
 
-    QRegExp                     m_rexDotDirective;
-    QRegExp                     m_rexInferenceRule;
-    QRegExp                     m_rexSingleWhiteSpace;
-
     Makefile*                   m_makefile;
     QStringList                 m_suffixes;
     QStringList                 m_activeTargets;
     QHash<QString, QStringList> m_syncPoints;
     QHash<QString, QVector<InferenceRule *> > m_ruleIdxByToExtension;
+    QHash<QString, FastFileInfo> m_listedDirectories;
 };
 
 } // namespace NMakeFile
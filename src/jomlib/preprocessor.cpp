@@ -39,9 +39,9 @@ namespace NMakeFile {
 Preprocessor::Preprocessor()
 :   m_macroTable(0),
     m_expressionParser(0),
-    m_bInlineFileMode(false)
+    m_bInlineFileMode(false),
+    m_bResultReproducible(true)
 {
-    m_rexPreprocessingDirective.setPattern(QLatin1String("^!\\s*(\\S+)(.*)"));
 }
 
 Preprocessor::~Preprocessor()
@@ -70,7 +70,7 @@ bool Preprocessor::internalOpenFile(QString fileName)
     // make file name absolute for safe cycle detection
     const QString origFileName = fileName;
     QFileInfo fileInfo(fileName);
-    if (!fileInfo.exists()) {
+    if (!fileExists(fileName)) {
         QString msg = QLatin1String("File %1 doesn't exist.");
         error(msg.arg(origFileName));
     }
@@ -150,12 +150,7 @@ void Preprocessor::basicReadLine(QString& line)
 
 bool Preprocessor::parseMacro(const QString& line)
 {
-    if (line.isEmpty())
-        return false;
-
-    static const QRegExp rex(QLatin1String("^(?:_|[a-z]|[0-9]|\\$)(?:[a-z]|[0-9]|\\$|=|\\()?"),
-                             Qt::CaseInsensitive, QRegExp::RegExp2);
-    if (rex.indexIn(line) != 0)
+    if (!MakefileTokenizer::mayBeMacroDefinition(line))
         return false;
 
     int equalsSignPos = -1;
@@ -191,78 +186,118 @@ bool Preprocessor::parseMacro(const QString& line)
 
 bool Preprocessor::parsePreprocessingDirective(const QString& line)
 {
-    QString directive, value;
-    QString expandedLine = m_macroTable->expandMacros(line);
-    if (!isPreprocessingDirective(expandedLine, directive, value))
+    if (!MakefileTokenizer::mayBePreprocessingDirective(line))
         return false;
 
-    if (directive == QLatin1String("CMDSWITCHES")) {
-    } else if (directive == QLatin1String("ERROR")) {
+    QString value;
+    const MakefileTokenizer::Directive directive = readPreprocessingDirective(line, &value);
+    switch (directive) {
+    case MakefileTokenizer::NoDirective:
+        return false;
+    case MakefileTokenizer::UnknownDirective:
+    case MakefileTokenizer::DirectiveCmdSwitches:
+        break;
+    case MakefileTokenizer::DirectiveError:
         error(QLatin1Literal("ERROR: ") + value);
-    } else if (directive == QLatin1String("MESSAGE")) {
+        break;
+    case MakefileTokenizer::DirectiveMessage:
         puts(qPrintable(value));
-    } else if (directive == QLatin1String("INCLUDE")) {
+        m_messages.append(value);
+        break;
+    case MakefileTokenizer::DirectiveInclude:
         internalOpenFile(findIncludeFile(value));
-    } else if (directive == QLatin1String("IF")) {
-        bool followElseBranch = evaluateExpression(value) == 0;
-        enterConditional(followElseBranch);
-        if (followElseBranch) {
-            skipUntilNextMatchingConditional();
-        }
-    } else if (directive == QLatin1String("IFDEF")) {
-        bool followElseBranch = !m_macroTable->isMacroDefined(value);
-        enterConditional(followElseBranch);
-        if (followElseBranch) {
-            skipUntilNextMatchingConditional();
-        }
-    } else if (directive == QLatin1String("IFNDEF")) {
-        bool followElseBranch = m_macroTable->isMacroDefined(value);
+        break;
+    case MakefileTokenizer::DirectiveIf:
+    case MakefileTokenizer::DirectiveIfDef:
+    case MakefileTokenizer::DirectiveIfNDef:
+    {
+        bool followElseBranch;
+        if (directive == MakefileTokenizer::DirectiveIf)
+            followElseBranch = evaluateExpression(value) == 0;
+        else
+            followElseBranch = m_macroTable->isMacroDefined(value)
+                    == (directive == MakefileTokenizer::DirectiveIfNDef);
         enterConditional(followElseBranch);
         if (followElseBranch) {
             skipUntilNextMatchingConditional();
         }
-    } else if (directive == QLatin1String("ELSE")) {
+        break;
+    }
+    case MakefileTokenizer::DirectiveElse:
         if (conditionalDepth() == 0)
             error(QLatin1String("unexpected ELSE"));
         if (!m_conditionalStack.top()) {
             skipUntilNextMatchingConditional();
         }
-    } else if (directive == QLatin1String("ELSEIF")) {
+        break;
+    case MakefileTokenizer::DirectiveElseIf:
+    case MakefileTokenizer::DirectiveElseIfDef:
+    case MakefileTokenizer::DirectiveElseIfNDef:
+    {
         if (conditionalDepth() == 0)
             error(QLatin1String("unexpected ELSE"));
-        if (!m_conditionalStack.top() || evaluateExpression(value) == 0) {
-            skipUntilNextMatchingConditional();
-        } else {
-            m_conditionalStack.pop();
-            m_conditionalStack.push(false);
+        bool takeBranch = m_conditionalStack.top();
+        if (takeBranch) {
+            if (directive == MakefileTokenizer::DirectiveElseIf)
+                takeBranch = evaluateExpression(value) != 0;
+            else
+                takeBranch = m_macroTable->isMacroDefined(value)
+                        == (directive == MakefileTokenizer::DirectiveElseIfDef);
         }
-    } else if (directive == QLatin1String("ELSEIFDEF")) {
-        if (conditionalDepth() == 0)
-            error(QLatin1String("unexpected ELSE"));
-        if (!m_conditionalStack.top() || !m_macroTable->isMacroDefined(value)) {
+        if (!takeBranch) {
             skipUntilNextMatchingConditional();
         } else {
             m_conditionalStack.pop();
             m_conditionalStack.push(false);
         }
-    } else if (directive == QLatin1String("ELSEIFNDEF")) {
-        if (conditionalDepth() == 0)
-            error(QLatin1String("unexpected ELSE"));
-        if (!m_conditionalStack.top() || m_macroTable->isMacroDefined(value)) {
-            skipUntilNextMatchingConditional();
-        } else {
-            m_conditionalStack.pop();
-            m_conditionalStack.push(false);
-        }
-    } else if (directive == QLatin1String("ENDIF")) {
+        break;
+    }
+    case MakefileTokenizer::DirectiveEndIf:
         exitConditional();
-    } else if (directive == QLatin1String("UNDEF")) {
+        break;
+    case MakefileTokenizer::DirectiveUndef:
         m_macroTable->undefineMacro(value);
+        break;
     }
 
     return true;
 }
 
+/**
+ * Returns whether the file exists. The result is cached, for existing and for
+ * missing files, until clearIncludeFileCache is called.
+ * The cached time stamp and size are taken before the file is read, so they don't
+ * match the file anymore if it changes while it is parsed.
+ */
+bool Preprocessor::fileExists(const QString &filePath)
+{
+    QHash<QString, FastFileInfo>::const_iterator it = m_fileExistsCache.constFind(filePath);
+    if (it != m_fileExistsCache.constEnd())
+        return it->exists();
+    const FastFileInfo fi(filePath, FastFileInfo::BypassCache);
+    m_fileExistsCache.insert(filePath, fi);
+    return fi.exists();
+}
+
+/**
+ * Forgets all cached include file lookups.
+ * Must be called when the file system might have changed, e.g. by commands
+ * that were run by the preprocessor.
+ */
+void Preprocessor::clearIncludeFileCache()
+{
+    m_fileExistsCache.clear();
+    m_includeFileCache.clear();
+}
+
+/**
+ * Returns the absolute path of the file to include.
+ *
+ * The result depends on the include directive's argument, on the directories
+ * of the including makefiles and, for angle brackets, on the INCLUDE macro.
+ * It is cached by all three, so that repeated includes don't probe the file
+ * system again.
+ */
 QString Preprocessor::findIncludeFile(const QString &filePathToInclude)
 {
     QString filePath = filePathToInclude;
@@ -274,78 +309,78 @@ QString Preprocessor::findIncludeFile(const QString &filePathToInclude)
     }
     removeDoubleQuotes(filePath);
 
-    QFileInfo fi(filePath);
-    if (fi.exists())
-        return fi.absoluteFilePath();
+    QString includeVar;
+    if (angleBrackets) {
+        includeVar = m_macroTable->macroValue(QLatin1String("INCLUDE"))
+                .replace(QLatin1Char('\t'), QLatin1Char(' '));
+    }
+
+    QString cacheKey = filePathToInclude;
+    cacheKey += QLatin1Char('\n');
+    cacheKey += includeVar;
+    foreach (const TextFile &textFile, m_fileStack) {
+        cacheKey += QLatin1Char('\n');
+        cacheKey += textFile.fileDirectory;
+    }
+    QHash<QString, QString>::const_iterator it = m_includeFileCache.constFind(cacheKey);
+    if (it != m_includeFileCache.constEnd())
+        return it.value();
+
+    const QString result = searchIncludeFile(filePath, includeVar);
+    if (result.isEmpty()) {
+        const QString msg = QLatin1String("File %1 cannot be found.");
+        error(msg.arg(filePathToInclude));
+    }
+    m_includeFileCache.insert(cacheKey, result);
+    return result;
+}
+
+QString Preprocessor::searchIncludeFile(const QString &filePath, const QString &includeVar)
+{
+    if (fileExists(filePath))
+        return QFileInfo(filePath).absoluteFilePath();
 
     // Search recursively through all directories of all parent makefiles.
     for (QStack<TextFile>::const_iterator it = m_fileStack.constEnd();
          it != m_fileStack.constBegin();) {
         --it;
-        fi.setFile(it->fileDirectory + QLatin1Char('/') + filePath);
-        if (fi.exists())
-            return fi.absoluteFilePath();
+        const QString candidate = it->fileDirectory + QLatin1Char('/') + filePath;
+        if (fileExists(candidate))
+            return QFileInfo(candidate).absoluteFilePath();
     }
 
-    if (angleBrackets) {
-        // Search through all directories in the INCLUDE macro.
-        const QString includeVar = m_macroTable->macroValue(QLatin1String("INCLUDE"))
-                .replace(QLatin1Char('\t'), QLatin1Char(' '));
-        const QStringList includeDirs = includeVar.split(QLatin1Char(';'), QString::SkipEmptyParts);
-        foreach (const QString& includeDir, includeDirs) {
-            fi.setFile(includeDir + QLatin1Char('/') + filePath);
-            if (fi.exists())
-                return fi.absoluteFilePath();
-        }
+    // Search through all directories in the INCLUDE macro.
+    const QStringList includeDirs = includeVar.split(QLatin1Char(';'), QString::SkipEmptyParts);
+    foreach (const QString& includeDir, includeDirs) {
+        const QString candidate = includeDir + QLatin1Char('/') + filePath;
+        if (fileExists(candidate))
+            return QFileInfo(candidate).absoluteFilePath();
     }
 
-    const QString msg = QLatin1String("File %1 cannot be found.");
-    error(msg.arg(filePathToInclude));
     return QString();
 }
 
-bool Preprocessor::isPreprocessingDirective(const QString& line, QString& directive, QString& value)
+/**
+ * Classifies the macro expanded line as preprocessing directive.
+ * The value of the directive is expanded again and stripped of comments.
+ */
+MakefileTokenizer::Directive Preprocessor::readPreprocessingDirective(const QString& line,
+                                                                      QString *value)
 {
-    if (line.isEmpty())
-        return false;
-
-    const QChar firstChar = line.at(0);
-    if (isSpaceOrTab(firstChar))
-        return false;
-
-    bool oldStyleIncludeDirectiveFound = false;
-    if (firstChar != QLatin1Char('!') && line.length() > 8) {
-        const char ch = line.at(7).toLatin1();
-        if (!isSpaceOrTab(QLatin1Char(ch)))
-            return false;
-
-        if (line.left(7).toLower() == QLatin1String("include"))
-            oldStyleIncludeDirectiveFound = true;
-        else
-            return false;
+    const QString expandedLine = m_macroTable->expandMacros(line);
+    const MakefileTokenizer::Directive directive
+            = MakefileTokenizer::preprocessingDirective(expandedLine, value);
+    if (directive != MakefileTokenizer::NoDirective) {
+        *value = m_macroTable->expandMacros(*value);
+        removeInlineComments(*value);
     }
-
-    bool result = true;
-    if (oldStyleIncludeDirectiveFound) {
-        directive = QLatin1String("INCLUDE");
-        value = line.mid(8);
-    } else {
-        result = m_rexPreprocessingDirective.exactMatch(line);
-        if (result) {
-            directive = m_rexPreprocessingDirective.cap(1).toUpper();
-            value = m_rexPreprocessingDirective.cap(2).trimmed();
-        }
-    }
-
-    value = m_macroTable->expandMacros(value);
-    removeInlineComments(value);
-    return result;
+    return directive;
 }
 
 void Preprocessor::skipUntilNextMatchingConditional()
 {
     uint depth = 0;
-    QString line, directive, value;
+    QString line;
 
     enum DirectiveToken { TOK_IF, TOK_ENDIF, TOK_ELSE, TOK_UNINTERESTING };
     DirectiveToken token;
@@ -354,15 +389,18 @@ void Preprocessor::skipUntilNextMatchingConditional()
         if (line.isNull())
             return;
 
-        QString expandedLine = m_macroTable->expandMacros(line);
-        if (!isPreprocessingDirective(expandedLine, directive, value))
+        // Skipped lines are only expanded if they might turn out to be directives.
+        if (!MakefileTokenizer::mayBePreprocessingDirective(line))
             continue;
 
-        if (directive == QLatin1String("ENDIF"))
+        const QString expandedLine = m_macroTable->expandMacros(line);
+        const MakefileTokenizer::Directive directive
+                = MakefileTokenizer::preprocessingDirective(expandedLine, 0);
+        if (directive == MakefileTokenizer::DirectiveEndIf)
             token = TOK_ENDIF;
-        else if (directive.startsWith(QLatin1String("IF")))
+        else if (MakefileTokenizer::isConditionalStart(directive))
             token = TOK_IF;
-        else if (directive.startsWith(QLatin1String("ELSE")))
+        else if (MakefileTokenizer::isConditionalAlternative(directive))
             token = TOK_ELSE;
         else
             token = TOK_UNINTERESTING;
@@ -408,7 +446,15 @@ int Preprocessor::evaluateExpression(const QString& expr)
         m_expressionParser->setMacroTable(m_macroTable);
     }
 
-    if (!m_expressionParser->parse(qPrintable(m_macroTable->expandMacros(expr)))) {
+    const QString expandedExpr = m_macroTable->expandMacros(expr);
+    const bool parsed = m_expressionParser->parse(qPrintable(expandedExpr));
+    if (expandedExpr.contains(QLatin1Char('['))) {
+        clearIncludeFileCache();    // The commands in brackets may have created files.
+        m_bResultReproducible = false;
+    } else if (expandedExpr.contains(QLatin1String("EXIST"), Qt::CaseInsensitive)) {
+        m_bResultReproducible = false;
+    }
+    if (!parsed) {
         QString msg = QLatin1String("Can't evaluate preprocessor expression.");
         msg += QLatin1String("\nerror: ");
         msg += QString::fromLatin1(m_expressionParser->errorMessage());
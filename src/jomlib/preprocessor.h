@@ -26,10 +26,13 @@
 #ifndef PREPROCESSOR_H
 #define PREPROCESSOR_H
 
-#include <QRegExp>
+#include <QHash>
 #include <QStack>
 #include <QStringList>
 
+#include "fastfileinfo.h"
+#include "makefiletokenizer.h"
+
 class PPExprParser;
 
 namespace NMakeFile {
@@ -55,13 +58,20 @@ public:
 
     static void removeInlineComments(QString& line);
 
+    const QHash<QString, FastFileInfo> &inputFiles() const { return m_fileExistsCache; }
+    const QStringList &messages() const { return m_messages; }
+    bool isResultReproducible() const { return m_bResultReproducible; }
+
 private:
     bool internalOpenFile(QString fileName);
     void basicReadLine(QString& line);
     bool parseMacro(const QString& line);
     bool parsePreprocessingDirective(const QString& line);
     QString findIncludeFile(const QString &filePathToInclude);
-    bool isPreprocessingDirective(const QString& line, QString& directive, QString& value);
+    QString searchIncludeFile(const QString &filePath, const QString &includeVar);
+    bool fileExists(const QString &filePath);
+    void clearIncludeFileCache();
+    MakefileTokenizer::Directive readPreprocessingDirective(const QString& line, QString *value);
     void skipUntilNextMatchingConditional();
     void error(const QString& msg);
     void enterConditional(bool followElseBranch);
@@ -92,11 +102,14 @@ private:
 
     QStack<TextFile>    m_fileStack;
     MacroTable*         m_macroTable;
-    QRegExp             m_rexPreprocessingDirective;
     QStack<bool>        m_conditionalStack;
     PPExprParser*       m_expressionParser;
     QStringList         m_linesPutBack;
+    QHash<QString, FastFileInfo> m_fileExistsCache;
+    QHash<QString, QString> m_includeFileCache;
     bool                m_bInlineFileMode;
+    QStringList         m_messages;
+    bool                m_bResultReproducible;  // false if shell commands or EXIST were evaluated
 };
 
 } //namespace NMakeFile
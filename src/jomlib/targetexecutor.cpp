@@ -24,13 +24,16 @@
 ****************************************************************************/
 
 #include "targetexecutor.h"
+#include "buildlog.h"
 #include "commandexecutor.h"
+#include "contenthashes.h"
 #include "dependencygraph.h"
 #include "jobclient.h"
 #include "options.h"
 #include "exception.h"
 
 #include <QDebug>
+#include <QDir>
 #include <QTextStream>
 #include <QCoreApplication>
 
@@ -38,15 +41,18 @@ namespace NMakeFile {
 
 TargetExecutor::TargetExecutor(const ProcessEnvironment &environment)
     : m_environment(environment)
+    , m_contentHashes(0)
     , m_jobClient(0)
     , m_bAborted(false)
+    , m_blockedTargetCount(0)
     , m_allCommandsSuccessfullyExecuted(true)
 {
     m_makefile = 0;
     m_depgraph = new DependencyGraph();
+    m_buildLog = new BuildLog();
 
     for (int i = 0; i < g_options.maxNumberOfJobs; ++i) {
-        CommandExecutor* executor = new CommandExecutor(this, environment);
+        CommandExecutor* executor = new CommandExecutor(this, environment, m_buildLog);
         connect(executor, SIGNAL(finished(CommandExecutor*, bool)),
                 this, SLOT(onChildFinished(CommandExecutor*, bool)));
 
@@ -60,11 +66,16 @@ TargetExecutor::TargetExecutor(const ProcessEnvironment &environment)
     }
     m_availableProcesses = m_processes;
     m_availableProcesses.first()->setBufferedOutput(false);
+
+    m_batchModeTimer.setSingleShot(true);
+    connect(&m_batchModeTimer, SIGNAL(timeout()), this, SLOT(startProcesses()));
 }
 
 TargetExecutor::~TargetExecutor()
 {
     delete m_depgraph;
+    delete m_buildLog;
+    delete m_contentHashes;
 }
 
 void TargetExecutor::apply(Makefile* mkfile, const QStringList& targets)
@@ -73,6 +84,7 @@ void TargetExecutor::apply(Makefile* mkfile, const QStringList& targets)
     m_allCommandsSuccessfullyExecuted = true;
     m_makefile = mkfile;
     m_jobAcquisitionCount = 0;
+    m_blockedTargetCount = 0;
     m_nextTarget = 0;
 
     if (!m_jobClient) {
@@ -84,25 +96,53 @@ void TargetExecutor::apply(Makefile* mkfile, const QStringList& targets)
         connect(m_jobClient, &JobClient::acquired, this, &TargetExecutor::buildNextTarget);
     }
 
-    DescriptionBlock* descblock;
+    QList<DescriptionBlock*> descblocks;
     if (targets.isEmpty()) {
         if (mkfile->targets().isEmpty())
             throw Exception(QLatin1String("no targets in makefile"));
 
-        descblock = mkfile->firstTarget();
+        descblocks.append(mkfile->firstTarget());
     } else {
-        const QString targetName = targets.first();
-        descblock = mkfile->target(targetName);
-        if (!descblock) {
-            QString msg = QLatin1String("Target %1 does not exist in %2.");
-            throw Exception(msg.arg(targetName, mkfile->fileName()));
+        foreach (const QString &targetName, targets) {
+            DescriptionBlock *descblock = mkfile->target(targetName);
+            if (!descblock) {
+                QString msg = QLatin1String("Target %1 does not exist in %2.");
+                throw Exception(msg.arg(targetName, mkfile->fileName()));
+            }
+            descblocks.append(descblock);
         }
-        for (int i=1; i < targets.count(); ++i) {
-            m_pendingTargets.append( mkfile->target(targets.at(i)) );
+        if (m_makefile->options()->buildTargetsSequentially) {
+            // nmake compatibility: build one target after another.
+            m_pendingTargets = descblocks.mid(1);
+            descblocks.erase(descblocks.begin() + 1, descblocks.end());
         }
     }
 
-    m_depgraph->build(descblock);
+    if (!m_makefile->options()->dumpDependencyGraph && !m_makefile->options()->dryRun) {
+        const QString logFileName = QDir(mkfile->dirPath()).filePath(BuildLog::defaultFileName());
+        if (m_buildLog->fileName() != logFileName && !m_buildLog->load(logFileName)) {
+            fprintf(stderr, "jom: Cannot read build log %s.\n",
+                    qPrintable(QDir::toNativeSeparators(logFileName)));
+        }
+        m_depgraph->setTargetDurations(m_buildLog->targetDurations());
+        m_depgraph->setBuildLog(m_buildLog);
+
+        if (m_makefile->options()->compareContentHashes) {
+            if (!m_contentHashes)
+                m_contentHashes = new ContentHashes();
+            const QString hashesFileName = QDir(mkfile->dirPath()).filePath(ContentHashes::defaultFileName());
+            if (m_contentHashes->fileName() != hashesFileName) {
+                m_contentHashes->save();
+                if (!m_contentHashes->load(hashesFileName)) {
+                    fprintf(stderr, "jom: Cannot read content hashes %s.\n",
+                            qPrintable(QDir::toNativeSeparators(hashesFileName)));
+                }
+            }
+            m_depgraph->setContentHashes(m_contentHashes);
+        }
+    }
+
+    m_depgraph->build(descblocks);
     if (m_makefile->options()->dumpDependencyGraph) {
         if (m_makefile->options()->dumpDependencyGraphDot)
             m_depgraph->dotDump();
@@ -112,6 +152,7 @@ void TargetExecutor::apply(Makefile* mkfile, const QStringList& targets)
         return;
     }
 
+    m_depgraph->pruneUpToDateSubgraphs(m_makefile->options()->buildAllTargets);
     QMetaObject::invokeMethod(this, "startProcesses", Qt::QueuedConnection);
 }
 
@@ -121,8 +162,11 @@ void TargetExecutor::startProcesses()
         return;
 
     try {
-        if (!m_nextTarget)
+        if (!m_nextTarget) {
             findNextTarget();
+            if (!m_nextTarget && applyBatchModeRules())
+                findNextTarget();
+        }
 
         if (m_nextTarget) {
             if (numberOfRunningProcesses() == 0) {
@@ -140,7 +184,8 @@ void TargetExecutor::startProcesses()
                 } else {
                     m_depgraph->clear();
                     m_makefile->invalidateTimeStamps();
-                    m_depgraph->build(m_pendingTargets.takeFirst());
+                    m_depgraph->build(QList<DescriptionBlock*>() << m_pendingTargets.takeFirst());
+                    m_depgraph->pruneUpToDateSubgraphs(m_makefile->options()->buildAllTargets);
                     QMetaObject::invokeMethod(this, "startProcesses", Qt::QueuedConnection);
                 }
             }
@@ -161,6 +206,8 @@ void TargetExecutor::buildNextTarget()
 
     try {
         CommandExecutor *executor = m_availableProcesses.takeFirst();
+        if (m_makefile->isRestatTarget(m_nextTarget))
+            snapshotOutputs(m_nextTarget);
         executor->start(m_nextTarget);
         m_nextTarget = 0;
         QMetaObject::invokeMethod(this, "startProcesses", Qt::QueuedConnection);
@@ -189,6 +236,16 @@ void TargetExecutor::waitForJobClient()
 
 void TargetExecutor::finishBuild(int exitCode)
 {
+    if (!m_buildLog->flush()) {
+        fprintf(stderr, "jom: Cannot write build log %s.\n",
+                qPrintable(QDir::toNativeSeparators(m_buildLog->fileName())));
+    }
+
+    if (m_contentHashes && !m_contentHashes->save()) {
+        fprintf(stderr, "jom: Cannot write content hashes %s.\n",
+                qPrintable(QDir::toNativeSeparators(m_contentHashes->fileName())));
+    }
+
     if (exitCode == 0
         && !m_allCommandsSuccessfullyExecuted
         && m_makefile->options()->buildUnrelatedTargetsOnError)
@@ -203,20 +260,153 @@ void TargetExecutor::findNextTarget()
 {
     forever {
         m_nextTarget = m_depgraph->findAvailableTarget(m_makefile->options()->buildAllTargets);
-        if (m_nextTarget) {
-            if (m_nextTarget->m_commands.isEmpty()) {
-                // Short cut for targets without commands.
-                m_depgraph->removeLeaf(m_nextTarget);
-                continue;
-            } else if (m_makefile->options()->buildUnrelatedTargetsOnError
-                       && m_depgraph->isUnbuildable(m_nextTarget)) {
-                fprintf(stderr, "jom: Target '%s' cannot be built due to failed dependencies.\n",
-                        qPrintable(m_nextTarget->targetName()));
-                m_depgraph->removeLeaf(m_nextTarget);
+        if (m_blockedTargetCount > 0)
+            reportBlockedTargets();
+        if (m_nextTarget && m_nextTarget->m_commands.isEmpty()) {
+            // Short cut for targets without commands.
+            m_depgraph->removeLeaf(m_nextTarget);
+            continue;
+        }
+        return;
+    }
+}
+
+/**
+ * Forms the batches for targets of batch mode inference rules.
+ *
+ * Waits up to /BATCHWINDOW milliseconds for more batch mode targets to become ready,
+ * unless no running process could produce new ones. The number of batches is the
+ * number of idle processes.
+ * Returns true if batches have been formed.
+ */
+bool TargetExecutor::applyBatchModeRules()
+{
+    if (!m_depgraph->hasPendingBatchModeTargets())
+        return false;
+
+    const qint64 remainingTime = m_makefile->options()->batchModeWindow
+                                 - m_depgraph->batchModeWaitingTime();
+    if (numberOfRunningProcesses() > 0 && remainingTime > 0) {
+        if (!m_batchModeTimer.isActive())
+            m_batchModeTimer.start(int(remainingTime));
+        return false;
+    }
+
+    m_batchModeTimer.stop();
+    m_depgraph->applyBatchModeRules(m_availableProcesses.count());
+    return true;
+}
+
+/**
+ * Prints the targets that the dependency graph discarded due to failed dependencies.
+ * The discarded targets are no longer counted as blocked.
+ */
+void TargetExecutor::reportBlockedTargets()
+{
+    int discardedCount;
+    foreach (DescriptionBlock *target, m_depgraph->takeBlockedTargets(&discardedCount)) {
+        fprintf(stderr, "jom: Target '%s' cannot be built due to failed dependencies.\n",
+                qPrintable(target->targetName()));
+    }
+    m_blockedTargetCount -= discardedCount;
+    Q_ASSERT(m_blockedTargetCount >= 0);
+}
+
+/**
+ * Remembers the time stamps of the outputs of a .RESTAT target before its commands are run.
+ * With /CONTENTHASH the contents are remembered, too.
+ */
+void TargetExecutor::snapshotOutputs(DescriptionBlock *target)
+{
+    QVector<OutputSnapshot> snapshots;
+    QStringList outputs = target->m_batchTargetNames;
+    outputs.prepend(target->targetName());
+    const FileTime snapshotTime = FileTime::currentTime();
+    foreach (const QString &output, outputs) {
+        FastFileInfo fi(output);
+        if (!fi.exists())
+            continue;
+        OutputSnapshot snapshot;
+        snapshot.fileName = output;
+        snapshot.lastModified = fi.lastModified();
+        snapshot.effectiveTime = snapshot.lastModified;
+        const BuildLog::Entry *entry = m_buildLog->entry(output);
+        if (entry && FileTime(entry->outputTime) == snapshot.lastModified)
+            snapshot.effectiveTime = FileTime(entry->effectiveTime);
+        snapshot.snapshotTime = snapshotTime;
+        snapshot.contentHash = 0;
+        if (m_contentHashes && !m_contentHashes->fileHash(output, &snapshot.contentHash))
+            continue;
+        snapshots.append(snapshot);
+    }
+    if (!snapshots.isEmpty())
+        m_outputSnapshots.insert(target, snapshots);
+}
+
+/**
+ * Compares the outputs of a .RESTAT target with the snapshot taken before its
+ * commands were run. Outputs that were not touched, or with /CONTENTHASH rewritten with
+ * the same content, get their old time stamp back, so that the targets depending on them
+ * stay up-to-date.
+ *
+ * The result is recorded in the build log. As long as the output's time stamp doesn't
+ * change, later runs see the old time stamp, too, and the .RESTAT target is up-to-date
+ * unless its dependents change again.
+ */
+void TargetExecutor::restoreUnchangedOutputs(DescriptionBlock *target)
+{
+    const QVector<OutputSnapshot> snapshots = m_outputSnapshots.take(target);
+    foreach (const OutputSnapshot &snapshot, snapshots) {
+        FastFileInfo fi(snapshot.fileName);
+        if (!fi.exists())
+            continue;
+        if (!(fi.lastModified() == snapshot.lastModified)) {
+            quint64 hash;
+            if (!m_contentHashes
+                || !m_contentHashes->fileHash(snapshot.fileName, &hash)
+                || hash != snapshot.contentHash)
+            {
                 continue;
             }
         }
-        return;
+
+        DescriptionBlock *output = (snapshot.fileName == target->targetName())
+                ? target : m_makefile->target(snapshot.fileName);
+        if (!output)
+            continue;
+        output->m_bFileExists = true;
+        output->m_timeStamp = snapshot.effectiveTime;
+
+        if (m_buildLog->isLoaded()) {
+            const BuildLog::Entry *oldEntry = m_buildLog->entry(snapshot.fileName);
+            BuildLog::Entry entry = oldEntry ? *oldEntry : BuildLog::Entry();
+            entry.outputTime = fi.lastModified().internalRepresentation();
+            entry.effectiveTime = snapshot.effectiveTime.internalRepresentation();
+            entry.checkTime = snapshot.snapshotTime.internalRepresentation();
+            m_buildLog->append(snapshot.fileName, entry);
+        }
+    }
+}
+
+/**
+ * Invalidates the cached time stamps of the directories the target's commands are known
+ * to write to: the directories of the target, of the other targets of its batch and of
+ * its named inline files.
+ *
+ * Files that the commands write elsewhere are not noticed. Such a file keeps its cached
+ * time stamp, or stays missing, until its directory is invalidated by another target.
+ * Files that other targets depend on should therefore be targets themselves.
+ */
+static void clearFileInfoCacheForOutputs(DescriptionBlock *target)
+{
+    FastFileInfo::clearCacheForFile(target->targetName());
+    foreach (const QString &batchTargetName, target->m_batchTargetNames)
+        FastFileInfo::clearCacheForFile(batchTargetName);
+    foreach (const Command &command, target->m_commands) {
+        foreach (const InlineFile *inlineFile, command.m_inlineFiles) {
+            if (!inlineFile->m_filename.isEmpty())
+                FastFileInfo::clearCacheForFile(inlineFile->m_filename);
+        }
     }
 }
 
@@ -228,11 +418,15 @@ void TargetExecutor::onChildFinished(CommandExecutor* executor, bool commandFail
         if (m_makefile->options()->buildUnrelatedTargetsOnError) {
             // Recursively mark all parents of this node as unbuildable due to unsatisfied
             // dependencies. This must happen before removing the node from the build graph.
-            m_depgraph->markParentsRecursivlyUnbuildable(executor->target());
+            m_blockedTargetCount += m_depgraph->markParentsRecursivlyUnbuildable(executor->target());
             fputs("jom: Option /K specified. Continuing.\n", stderr);
         }
     }
-    FastFileInfo::clearCacheForFile(executor->target()->targetName());
+    clearFileInfoCacheForOutputs(executor->target());
+    if (!commandFailed)
+        restoreUnchangedOutputs(executor->target());
+    if (m_contentHashes && !commandFailed)
+        m_contentHashes->recordTarget(executor->target());
     m_depgraph->removeLeaf(executor->target());
     if (m_jobAcquisitionCount > 0) {
         m_jobClient->release();
@@ -29,6 +29,7 @@
 #include "makefile.h"
 #include <QObject>
 #include <QEvent>
+#include <QTimer>
 #include <QtCore/QMap>
 
 QT_BEGIN_NAMESPACE
@@ -37,7 +38,9 @@ QT_END_NAMESPACE
 
 namespace NMakeFile {
 
+class BuildLog;
 class CommandExecutor;
+class ContentHashes;
 class DependencyGraph;
 class JobClient;
 
@@ -64,19 +67,37 @@ private:
     void waitForJobClient();
     void finishBuild(int exitCode);
     void findNextTarget();
+    bool applyBatchModeRules();
+    void reportBlockedTargets();
+    void snapshotOutputs(DescriptionBlock *target);
+    void restoreUnchangedOutputs(DescriptionBlock *target);
 
 private:
     ProcessEnvironment m_environment;
     Makefile* m_makefile;
     DependencyGraph* m_depgraph;
+    BuildLog* m_buildLog;
+    ContentHashes* m_contentHashes;     // 0 unless /CONTENTHASH is given
     QList<DescriptionBlock*> m_pendingTargets;
     JobClient *m_jobClient;
     bool m_bAborted;
     int m_jobAcquisitionCount;
+    int m_blockedTargetCount;       // targets that cannot be built due to failed dependencies
     QList<CommandExecutor*> m_availableProcesses;
     QList<CommandExecutor*> m_processes;
     DescriptionBlock *m_nextTarget;
+    QTimer m_batchModeTimer;
     bool m_allCommandsSuccessfullyExecuted;
+
+    struct OutputSnapshot
+    {
+        QString fileName;
+        FileTime lastModified;
+        FileTime effectiveTime;     // differs from lastModified after an earlier .RESTAT check
+        FileTime snapshotTime;
+        quint64 contentHash;    // only set with /CONTENTHASH
+    };
+    QHash<DescriptionBlock *, QVector<OutputSnapshot> > m_outputSnapshots;   // .RESTAT targets
 };
 
 } //namespace NMakeFile
@@ -0,0 +1,4 @@
+.cpp.obj::
+	@echo $<
+
+all: foo1.obj foo3.obj foo4.obj
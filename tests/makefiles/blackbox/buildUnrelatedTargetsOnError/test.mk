@@ -1,7 +1,7 @@
 # test the /k option
 # When running "jom /f test.mk /k" the target "dependsOnFailingTarget" must not be built.
 
-first: workingTarget dependsOnFailingTarget
+first: workingTarget dependsOnFailingTarget noMatchingInferenceRule.obj
 
 failingTarget:
     cmd /c exit 7
@@ -11,3 +11,9 @@ dependsOnFailingTarget: failingTarget
 
 workingTarget:
     @echo Yay! This always works!
+
+.cpp.obj:
+    @echo We should not see this either.
+
+# There's no noMatchingInferenceRule.cpp. The target has nothing to build and is not reported.
+noMatchingInferenceRule.obj: failingTarget
@@ -0,0 +1,13 @@
+# test the detection of changed commands
+# output.txt is rebuilt if the value of FLAGS changes.
+
+FLAGS=a
+
+all: output.txt
+
+clean:
+	@del output.txt > NUL 2>&1
+
+output.txt:
+	@echo $@ $(FLAGS)
+	@echo $(FLAGS) > $@
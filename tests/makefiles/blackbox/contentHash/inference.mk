@@ -0,0 +1,15 @@
+# test the /CONTENTHASH option with inference rules
+# inferred.out is only rebuilt if the contents of inferred.txt change, also if its
+# content hash was recorded while it was up-to-date.
+
+.SUFFIXES: .txt .out
+
+all: inferred.out
+
+clean:
+	@del inferred.txt inferred.out .jom_hashes > NUL 2>&1
+	@echo inferred > inferred.txt
+
+.txt.out:
+	@echo $@
+	@copy $< $@ > NUL
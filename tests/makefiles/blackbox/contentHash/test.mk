@@ -0,0 +1,14 @@
+# test the /CONTENTHASH option
+# output.txt is only rebuilt if the contents of input.txt change.
+
+all: output.txt
+
+clean:
+	@del input.txt output.txt .jom_hashes > NUL 2>&1
+
+input.txt:
+	@echo input > $@
+
+output.txt: input.txt
+	@echo $@
+	@copy input.txt $@ > NUL
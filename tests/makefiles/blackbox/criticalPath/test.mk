@@ -0,0 +1,13 @@
+# test the /CRITICALPATH option
+# "c" is on the longest dependency chain and must be built first.
+
+all: a b
+
+a:
+	@echo a
+
+b: c
+	@echo b
+
+c:
+	@echo c
@@ -0,0 +1,11 @@
+# test building multiple command line targets
+# "shared" is built only once unless /SEQUENTIALTARGETS is specified.
+
+a: shared
+	@echo a
+
+b: shared
+	@echo b
+
+shared:
+	@echo shared
@@ -0,0 +1,21 @@
+# test the .RESTAT directive
+# generated.h is only written if it doesn't exist. Touching input.txt runs
+# its commands, but output.txt is not rebuilt because generated.h didn't change.
+
+.RESTAT: generated.h
+
+all: output.txt
+
+clean:
+	@del input.txt generated.h output.txt > NUL 2>&1
+
+input.txt:
+	@echo input > $@
+
+generated.h: input.txt
+	@echo $@
+	@if not exist $@ echo generated > $@
+
+output.txt: generated.h
+	@echo $@
+	@copy generated.h $@ > NUL
@@ -0,0 +1,4 @@
+all: Foo bar.txt
+
+foo:
+	@echo foo
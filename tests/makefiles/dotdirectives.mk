@@ -1,4 +1,4 @@
-all: silence ignorance preciousness suffixes
+all: silence ignorance preciousness restatness suffixes
 
 silence: silence_one silence_two silence_three
 silence_one:
@@ -27,5 +27,10 @@ preciousness_one:
 preciousness_two:
 preciousness_three:
 
+restatness: restatness_one restatness_two
+$(NOT_DEFINED).RESTAT : RESTATNESS_ONE .c.obj
+restatness_one:
+restatness_two:
+
 $(NOT_DEFINED).SUFFIXES: .exe .obj
 suffixes:
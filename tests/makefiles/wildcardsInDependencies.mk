@@ -1,2 +1,3 @@
 all: *.txt foo?.cpp
 more: subdir\*.cpp
+again: foo?.cpp
@@ -27,12 +27,22 @@
 
 #include <QTest>
 #include <QDir>
+#include <QDirIterator>
 #include <QScopedPointer>
 #include <QDebug>
 #include <QStringBuilder>
+#include <QTemporaryDir>
+#include <QThreadPool>
 
+#include <buildlog.h>
+#include <contenthashes.h>
+#include <dependencygraph.h>
+#include <fastfileinfo.h>
 #include <ppexprparser.h>
+#include <makefilecache.h>
 #include <makefilefactory.h>
+#include <makefilelinereader.h>
+#include <makefiletokenizer.h>
 #include <preprocessor.h>
 #include <parser.h>
 #include <options.h>
@@ -43,6 +53,29 @@
 
 using namespace NMakeFile;
 
+/**
+ * Removes the build logs, content hashes and makefile caches that jom writes
+ * next to the test makefiles in the current directory and its subdirectories.
+ */
+static void removeJomStateFiles()
+{
+    const QStringList names = QStringList() << BuildLog::defaultFileName()
+                                            << ContentHashes::defaultFileName()
+                                            << MakefileCache::directoryName();
+    QStringList paths;
+    QDirIterator it(QDir::currentPath(), names,
+                    QDir::Files | QDir::Dirs | QDir::Hidden | QDir::NoDotAndDotDot,
+                    QDirIterator::Subdirectories);
+    while (it.hasNext())
+        paths.append(it.next());
+    foreach (const QString &path, paths) {
+        if (QFileInfo(path).isDir())
+            QDir(path).removeRecursively();
+        else
+            QFile::remove(path);
+    }
+}
+
 void Tests::initTestCase()
 {
     m_makefileFactory = new MakefileFactory;
@@ -50,10 +83,12 @@ void Tests::initTestCase()
     m_jomProcess = new QProcess(this);
     m_oldCurrentPath = QDir::currentPath();
     QDir::setCurrent(QFINDTESTDATA("makefiles"));
+    removeJomStateFiles();
 }
 
 void Tests::cleanupTestCase()
 {
+    removeJomStateFiles();
     delete m_makefileFactory;
     delete m_preprocessor;
     QDir::setCurrent(m_oldCurrentPath);
@@ -106,6 +141,113 @@ void Tests::includeCycle()
     QVERIFY(bExceptionCaught);
 }
 
+static bool writeFile(const QString &fileName, const QByteArray &content)
+{
+    QFile file(fileName);
+    return file.open(QIODevice::WriteOnly) && file.write(content) == content.size();
+}
+
+void Tests::includeFileCache()
+{
+    QTemporaryDir tempDir;
+    QVERIFY(tempDir.isValid());
+    const QString dirPath = tempDir.path();
+    QVERIFY(QDir(dirPath).mkdir(QLatin1String("sub")));
+    QVERIFY(writeFile(dirPath + QLatin1String("/sub/inc.mk"), "FROM=sub\n"));
+    QVERIFY(writeFile(dirPath + QLatin1String("/test.mk"),
+                      "INCLUDE=" + QFile::encodeName(dirPath) + "/sub\n"
+                      "!INCLUDE <inc.mk>\n"
+                      "FIRST=$(FROM)\n"
+                      "marker1:\n"
+                      "!INCLUDE <inc.mk>\n"
+                      "SECOND=$(FROM)\n"
+                      "INCLUDE=$(INCLUDE);\n"
+                      "!INCLUDE <inc.mk>\n"
+                      "THIRD=$(FROM)\n"
+                      "!IF [cd .]\n"
+                      "!ENDIF\n"
+                      "!INCLUDE <inc.mk>\n"
+                      "FOURTH=$(FROM)\n"
+                      "marker2:\n"));
+
+    MacroTable macroTable;
+    Preprocessor pp;
+    pp.setMacroTable(&macroTable);
+    QVERIFY(pp.openFile(dirPath + QLatin1String("/test.mk")));
+    QCOMPARE(pp.readLine(), QLatin1String("marker1:"));
+    QCOMPARE(macroTable.macroValue("FIRST"), QLatin1String("sub"));
+    QVERIFY(pp.isResultReproducible());
+
+    // inc.mk next to the makefile takes precedence over the INCLUDE directories,
+    // but the preprocessor has already looked for it.
+    QVERIFY(writeFile(dirPath + QLatin1String("/inc.mk"), "FROM=top\n"));
+    QCOMPARE(pp.readLine(), QLatin1String("marker2:"));
+
+    // The repeated include is resolved from the cache.
+    QCOMPARE(macroTable.macroValue("SECOND"), QLatin1String("sub"));
+
+    // A different INCLUDE macro resolves the include again, but the missing file
+    // next to the makefile is remembered.
+    QCOMPARE(macroTable.macroValue("THIRD"), QLatin1String("sub"));
+
+    // Shell commands might create files, so they clear the cache.
+    QCOMPARE(macroTable.macroValue("FOURTH"), QLatin1String("top"));
+    QVERIFY(!pp.isResultReproducible());
+}
+
+void Tests::lineReader()
+{
+    QTemporaryDir tempDir;
+    QVERIFY(tempDir.isValid());
+    const QString fileName = tempDir.path() + QLatin1String("/lines.mk");
+    QFile file(fileName);
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    file.write("# comment\r\n"
+               "a line that is longer than sixteen characters   \r\n"
+               "continued \\\r\n"
+               "# comment within a continuation\n"
+               "\t\tline\n"
+               "escaped ^\\\n"
+               "caret^\n"
+               "newline\n"
+               "stray\rcarriage return\n"
+               "no trailing newline \\");
+    file.close();
+
+    MakefileLineReader reader(fileName);
+    QVERIFY(reader.open());
+    QCOMPARE(reader.readLine(false), QLatin1String("a line that is longer than sixteen characters"));
+    QCOMPARE(reader.lineNumber(), 2u);
+    QCOMPARE(reader.readLine(false), QLatin1String("continued  line"));
+    QCOMPARE(reader.lineNumber(), 5u);
+    QCOMPARE(reader.readLine(false), QLatin1String("escaped \\"));
+    QCOMPARE(reader.readLine(false), QLatin1String("caret\nnewline"));
+    QCOMPARE(reader.readLine(true), QLatin1String("straycarriage return\n"));
+    QCOMPARE(reader.readLine(true), QLatin1String("no trailing newline \\"));
+    QVERIFY(reader.readLine(false).isNull());
+    reader.close();
+
+    const QString unicodeText = QString::fromUtf8("\xd0\xba\xd1\x83\xd0\xb4\xd0\xb0 \xd0\xaf");
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    file.write("\xEF\xBB\xBF# comment\r\n");
+    file.write(unicodeText.toUtf8() + " \\\r\n\t" + unicodeText.toUtf8() + "\r\n");
+    file.close();
+    QVERIFY(reader.open());
+    QCOMPARE(reader.readLine(false), unicodeText + QLatin1String("  ") + unicodeText);
+    QVERIFY(reader.readLine(false).isNull());
+    reader.close();
+
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    file.write("\xFF\xFE");
+    const QString utf16Text = unicodeText + QLatin1String("\r\n") + unicodeText;
+    file.write(reinterpret_cast<const char *>(utf16Text.utf16()), utf16Text.length() * 2);
+    file.close();
+    QVERIFY(reader.open());
+    QCOMPARE(reader.readLine(false), unicodeText);
+    QCOMPARE(reader.readLine(true), unicodeText);
+    QVERIFY(reader.readLine(false).isNull());
+}
+
 void Tests::macros()
 {
     MacroTable macroTable;
@@ -151,6 +293,37 @@ void Tests::macros()
     QVERIFY(!bExceptionCaught);
 }
 
+void Tests::macroExpansionCache()
+{
+    MacroTable macroTable;
+    macroTable.setMacroValue("OBJECTS", "$(NAME).obj other.obj");
+    macroTable.setMacroValue("NAME", "foo");
+    QCOMPARE(macroTable.expandMacros("$(OBJECTS)"), QLatin1String("foo.obj other.obj"));
+    QCOMPARE(macroTable.expandMacros("$(OBJECTS:.obj=.cpp)"), QLatin1String("foo.cpp other.cpp"));
+
+    // Changing a macro invalidates all expansions that depend on it.
+    macroTable.setMacroValue("NAME", "bar");
+    QCOMPARE(macroTable.expandMacros("$(OBJECTS)"), QLatin1String("bar.obj other.obj"));
+    QCOMPARE(macroTable.expandMacros("$(OBJECTS:.obj=.cpp)"), QLatin1String("bar.cpp other.cpp"));
+
+    macroTable.undefineMacro("NAME");
+    QCOMPARE(macroTable.expandMacros("$(OBJECTS:.obj=.cpp)"), QLatin1String(".cpp other.cpp"));
+
+    // Defining a previously undefined macro invalidates expansions too.
+    macroTable.setMacroValue("NAME", "baz");
+    QCOMPARE(macroTable.expandMacros("$(OBJECTS:.obj=.cpp)"), QLatin1String("baz.cpp other.cpp"));
+
+    // Cycles are still detected.
+    macroTable.setMacroValue("NAME", "$(OBJECTS)");
+    bool exceptionCaught = false;
+    try {
+        macroTable.expandMacros("$(OBJECTS)");
+    } catch (Exception &) {
+        exceptionCaught = true;
+    }
+    QVERIFY(exceptionCaught);
+}
+
 void Tests::invalidMacros_data()
 {
     QTest::addColumn<QString>("expression");
@@ -334,6 +507,49 @@ void Tests::conditionals()
     QCOMPARE(macroTable->macroValue("TEST10"), QLatin1String("foo  bar  boo  hoo"));
 }
 
+void Tests::tokenizer()
+{
+    QString value;
+    QCOMPARE(MakefileTokenizer::preprocessingDirective(QLatin1String("!  ifdef FOO  "), &value),
+             MakefileTokenizer::DirectiveIfDef);
+    QCOMPARE(value, QLatin1String("FOO"));
+    QCOMPARE(MakefileTokenizer::preprocessingDirective(QLatin1String("include foo.mk"), &value),
+             MakefileTokenizer::DirectiveInclude);
+    QCOMPARE(value, QLatin1String("foo.mk"));
+    QCOMPARE(MakefileTokenizer::preprocessingDirective(QLatin1String("includes: foo.mk"), &value),
+             MakefileTokenizer::NoDirective);
+    QCOMPARE(MakefileTokenizer::preprocessingDirective(QLatin1String("!  "), &value),
+             MakefileTokenizer::NoDirective);
+    QCOMPARE(MakefileTokenizer::preprocessingDirective(QLatin1String("!FOO bar"), &value),
+             MakefileTokenizer::UnknownDirective);
+
+    QCOMPARE(MakefileTokenizer::dotDirective(QLatin1String(".SUFFIXES : .c .cpp"), &value),
+             MakefileTokenizer::DotDirectiveSuffixes);
+    QCOMPARE(value, QLatin1String(" .c .cpp"));
+    QCOMPARE(MakefileTokenizer::dotDirective(QLatin1String(".suffixes:"), &value),
+             MakefileTokenizer::NoDotDirective);
+    QCOMPARE(MakefileTokenizer::dotDirective(QLatin1String(".SILENTLY:"), &value),
+             MakefileTokenizer::NoDotDirective);
+
+    MakefileTokenizer::InferenceRuleHeader header;
+    QVERIFY(MakefileTokenizer::inferenceRule(QLatin1String("{src\\}.cpp{obj\\}.obj::"), &header));
+    QCOMPARE(header.fromPath, QLatin1String("src\\"));
+    QCOMPARE(header.fromExtension, QLatin1String(".cpp"));
+    QCOMPARE(header.toPath, QLatin1String("obj\\"));
+    QCOMPARE(header.toExtension, QLatin1String(".obj"));
+    QVERIFY(header.batchMode);
+    QVERIFY(MakefileTokenizer::inferenceRule(QLatin1String(".c.obj:"), &header));
+    QVERIFY(header.fromPath.isEmpty());
+    QVERIFY(header.toPath.isEmpty());
+    QVERIFY(!header.batchMode);
+    QVERIFY(!MakefileTokenizer::inferenceRule(QLatin1String(".c.obj: foo.h"), &header));
+    QVERIFY(!MakefileTokenizer::inferenceRule(QLatin1String("foo.c.obj:"), &header));
+
+    QVERIFY(!MakefileTokenizer::classificationDependsOnMacros(QLatin1String("foo: $(BAR)")));
+    QVERIFY(MakefileTokenizer::classificationDependsOnMacros(QLatin1String("$(EXT).obj:")));
+    QVERIFY(!MakefileTokenizer::classificationDependsOnMacros(QLatin1String(".c.obj:")));
+}
+
 void Tests::dotDirectives()
 {
     QVERIFY( openMakefile(QLatin1String("dotdirectives.mk")) );
@@ -383,6 +599,13 @@ void Tests::dotDirectives()
     QCOMPARE(mkfile->preciousTargets().at(0), QLatin1String("preciousness_one"));
     QCOMPARE(mkfile->preciousTargets().at(1), QLatin1String("preciousness_two"));
     QCOMPARE(mkfile->preciousTargets().at(2), QLatin1String("preciousness_three"));
+
+    target = mkfile->target(QLatin1String("restatness_one"));
+    QVERIFY(target != 0);
+    QVERIFY(mkfile->isRestatTarget(target));
+    target = mkfile->target(QLatin1String("restatness_two"));
+    QVERIFY(target != 0);
+    QVERIFY(!mkfile->isRestatTarget(target));
 }
 
 void Tests::descriptionBlocks()
@@ -514,6 +737,7 @@ void Tests::inferenceRules()
         QVERIFY(target->m_commands.count() == 0);
         system("echo.>" + fileToCreate.toLocal8Bit());
         QVERIFY(QFile::exists(fileToCreate));
+        FastFileInfo::clearCacheForFile(fileToCreate);
         mkfile->applyInferenceRules(QList<DescriptionBlock*>() << target);
         system("del " + fileToCreate.toLocal8Bit());
         QVERIFY(!QFile::exists(fileToCreate));
@@ -522,6 +746,41 @@ void Tests::inferenceRules()
     QCOMPARE(target->m_commands.first().m_commandLine, expectedCommandLine);
 }
 
+void Tests::batchModeRules()
+{
+    QVERIFY(openMakefile(QLatin1String("batchmode.mk")));
+    QScopedPointer<Makefile> mkfile(m_makefileFactory->makefile());
+    QVERIFY(mkfile);
+
+    QList<DescriptionBlock*> targets;
+    foreach (const QString &targetName, QStringList() << "foo1.obj" << "foo3.obj" << "foo4.obj") {
+        DescriptionBlock *target = mkfile->target(targetName);
+        QVERIFY(target);
+        targets.append(target);
+    }
+    QCOMPARE(mkfile->applyInferenceRules(targets).count(), 3);
+    foreach (DescriptionBlock *target, targets)
+        QVERIFY(target->m_commands.isEmpty());
+
+    // foo1.obj is expensive and gets a batch of its own.
+    QHash<QString, quint32> durations;
+    durations.insert("foo1.obj", 1000);
+    durations.insert("foo3.obj", 10);
+    durations.insert("foo4.obj", 10);
+    mkfile->applyBatchModeRules(2, durations);
+
+    DescriptionBlock *foo1 = targets.first();
+    QCOMPARE(foo1->m_commands.count(), 1);
+    QVERIFY(foo1->m_batchTargetNames.isEmpty());
+
+    DescriptionBlock *foo3 = targets.at(1);
+    DescriptionBlock *foo4 = targets.at(2);
+    QCOMPARE(foo3->m_commands.count() + foo4->m_commands.count(), 1);
+    DescriptionBlock *executingTarget = foo3->m_commands.isEmpty() ? foo4 : foo3;
+    DescriptionBlock *otherTarget = executingTarget == foo3 ? foo4 : foo3;
+    QCOMPARE(executingTarget->m_batchTargetNames, QStringList() << otherTarget->targetName());
+}
+
 void Tests::cycleInTargets()
 {
     MacroTable *macroTable = new MacroTable;
@@ -536,8 +795,9 @@ void Tests::cycleInTargets()
     try {
         QVERIFY( pp.openFile(QLatin1String("cycle_in_targets.mk")) );
         parser.apply(&pp, &mkfile);
-    } catch (...) {
+    } catch (Exception &e) {
         exceptionThrown = true;
+        QVERIFY(e.message().endsWith("foo -> bar -> schnusel -> foo"));
     }
     QVERIFY(exceptionThrown);
 }
@@ -577,6 +837,33 @@ void Tests::multipleTargets()
     QCOMPARE(target->m_commands.count(), 3);
 }
 
+void Tests::dependentTargets()
+{
+    QVERIFY( openMakefile(QLatin1String("dependenttargets.mk")) );
+    QScopedPointer<Makefile> mkfile(m_makefileFactory->makefile());
+    QVERIFY(mkfile);
+    DescriptionBlock* target = mkfile->target("all");
+    QVERIFY(target);
+    DescriptionBlock* foo = mkfile->target("foo");
+    QVERIFY(foo);
+
+    // Dependents are resolved case-insensitively. Plain files resolve to 0.
+    QCOMPARE(target->dependentTargets().count(), 2);
+    QCOMPARE(target->dependentTargets().at(0), foo);
+    QVERIFY(!target->dependentTargets().at(1));
+
+    // Adding a target resolves the dependents again.
+    DescriptionBlock* bar = new DescriptionBlock(mkfile.data());
+    bar->setTargetName(QLatin1String("bar.txt"));
+    mkfile->append(bar);
+    QCOMPARE(target->dependentTargets().at(1), bar);
+
+    // Appended dependents are resolved on demand.
+    target->m_dependents.append(QLatin1String("FOO"));
+    QCOMPARE(target->dependentTargets().count(), 3);
+    QCOMPARE(target->dependentTargets().at(2), foo);
+}
+
 void Tests::commandModifiers()
 {
     QVERIFY( openMakefile(QLatin1String("commandmodifiers.mk")) );
@@ -899,6 +1186,15 @@ void Tests::wildcardsInDependencies()
     QCOMPARE(target->m_dependents.at(0), QLatin1String("subdir\\foo1.cpp"));
     QCOMPARE(target->m_dependents.at(1), QLatin1String("subdir\\foo2.cpp"));
     QCOMPARE(target->m_dependents.at(2), QLatin1String("subdir\\foo4.cpp"));
+
+    // The second expansion in the same directory gives the same result.
+    // fileInfoCacheWildcards checks that it is answered from the cache.
+    target = mkfile->target("again");
+    QVERIFY(target);
+    QCOMPARE(target->m_dependents.count(), 3);
+    QCOMPARE(target->m_dependents.at(0), QLatin1String("foo1.cpp"));
+    QCOMPARE(target->m_dependents.at(1), QLatin1String("foo3.cpp"));
+    QCOMPARE(target->m_dependents.at(2), QLatin1String("foo4.cpp"));
 }
 
 void Tests::windowsPathsInTargetName()
@@ -926,6 +1222,75 @@ void Tests::windowsPathsInTargetName()
     QCOMPARE(target->m_commands.count(), 2);
 }
 
+void Tests::pruneUpToDateSubgraphs()
+{
+    // The directory is created in the current directory,
+    // so that the makefile can refer to the files by relative paths.
+    QTemporaryDir tempDir(QLatin1String("pruneUpToDateSubgraphs-XXXXXX"));
+    QVERIFY(tempDir.isValid());
+    const QString dirName = QFileInfo(tempDir.path()).fileName();
+    const QString makefileName = tempDir.path() + QLatin1String("/test.mk");
+    QVERIFY(writeFile(makefileName,
+                      "D=" + QFile::encodeName(dirName) + "\n"
+                      "$(D)/app.exe: $(D)/app.obj\n"
+                      "\t@echo $@\n"
+                      "$(D)/app.obj: $(D)/app.cpp\n"
+                      "\t@echo $@\n"
+                      "$(D)/tool.exe: $(D)/tool.obj\n"
+                      "\t@echo $@\n"
+                      "$(D)/tool.obj: $(D)/tool.cpp\n"
+                      "\t@echo $@\n"));
+    const QString appExe = QDir::toNativeSeparators(dirName + QLatin1String("/app.exe"));
+    const QString appObj = QDir::toNativeSeparators(dirName + QLatin1String("/app.obj"));
+    const QString toolExe = QDir::toNativeSeparators(dirName + QLatin1String("/tool.exe"));
+    const QString toolObj = QDir::toNativeSeparators(dirName + QLatin1String("/tool.obj"));
+
+    // app.exe is up-to-date, tool.exe must be built.
+    QVERIFY(writeFile(dirName + QLatin1String("/app.cpp"), QByteArray()));
+    QVERIFY(writeFile(appObj, QByteArray()));
+    QVERIFY(writeFile(appExe, QByteArray()));
+    QVERIFY(writeFile(dirName + QLatin1String("/tool.cpp"), QByteArray()));
+
+    QVERIFY(openMakefile(makefileName));
+    QScopedPointer<Makefile> mkfile(m_makefileFactory->makefile());
+    QVERIFY(mkfile);
+    const QList<DescriptionBlock *> roots = QList<DescriptionBlock *>()
+            << mkfile->target(appExe) << mkfile->target(toolExe);
+    QVERIFY(!roots.contains(0));
+
+    // Both command line targets share one graph. The up-to-date subgraph of app.exe
+    // is removed before the first target is taken. Removing app.obj afterwards
+    // doesn't bring it back.
+    DependencyGraph graph;
+    graph.build(roots);
+    graph.pruneUpToDateSubgraphs(false);
+    QVERIFY(QFile::remove(appObj));
+    FastFileInfo::clearCacheForFile(appObj);
+    QStringList targetNames;
+    while (DescriptionBlock *target = graph.findAvailableTarget(false)) {
+        targetNames.append(target->targetName());
+        graph.removeLeaf(target);
+    }
+    QCOMPARE(targetNames, QStringList() << toolObj << toolExe);
+    QVERIFY(graph.isEmpty());
+
+    // With /A nothing is pruned.
+    QVERIFY(writeFile(appObj, QByteArray()));
+    FastFileInfo::clearCacheForFile(appObj);
+    mkfile->invalidateTimeStamps();
+    graph.clear();
+    graph.build(roots);
+    graph.pruneUpToDateSubgraphs(true);
+    targetNames.clear();
+    while (DescriptionBlock *target = graph.findAvailableTarget(true)) {
+        targetNames.append(target->targetName());
+        graph.removeLeaf(target);
+    }
+    targetNames.sort();
+    QCOMPARE(targetNames, QStringList() << appExe << appObj << toolExe << toolObj);
+    QVERIFY(graph.isEmpty());
+}
+
 /**
  * Note: this function clears the environment of m_jomProcess after every start.
  */
@@ -1012,16 +1377,311 @@ QStringList Tests::readJomStdOutput()
     return s;
 }
 
+void Tests::buildLog()
+{
+    QTemporaryDir tempDir;
+    QVERIFY(tempDir.isValid());
+    const QString logFileName = tempDir.path() + QLatin1String("/.jom_log");
+
+    {
+        BuildLog log;
+        QVERIFY(log.load(logFileName));
+        QCOMPARE(log.count(), 0);
+        BuildLog::Entry entry;
+        entry.startTime = 1000;
+        entry.endTime = 1500;
+        entry.commandHash = 0x1234567890abcdefULL;
+        entry.outputTime = 3;
+        entry.effectiveTime = 1;
+        entry.checkTime = 2;
+        log.append(QLatin1String("Foo.obj"), entry);
+        entry.exitCode = 2;
+        log.append(QLatin1String("bar.obj"), entry);
+        QVERIFY(!QFile::exists(logFileName));
+        QVERIFY(log.flush());
+        QVERIFY(QFile::exists(logFileName));
+        for (int i = 0; i < 2000; ++i) {
+            entry.exitCode = 0;
+            entry.endTime = 1000 + i;
+            log.append(QLatin1String("baz.obj"), entry);
+        }
+    }
+
+    const qint64 logSize = QFileInfo(logFileName).size();
+    BuildLog log;
+    QVERIFY(log.load(logFileName));
+    QCOMPARE(log.count(), 3);
+    QVERIFY(QFileInfo(logFileName).size() < logSize);
+
+    const BuildLog::Entry *entry = log.entry(QLatin1String("foo.OBJ"));
+    QVERIFY(entry);
+    QCOMPARE(entry->duration(), 500u);
+    QCOMPARE(entry->exitCode, 0);
+    QCOMPARE(entry->commandHash, 0x1234567890abcdefULL);
+    QCOMPARE(entry->outputTime, 3ULL);
+    QCOMPARE(entry->effectiveTime, 1ULL);
+    QCOMPARE(entry->checkTime, 2ULL);
+    entry = log.entry(QLatin1String("baz.obj"));
+    QVERIFY(entry);
+    QCOMPARE(entry->duration(), 999u);
+    QVERIFY(!log.entry(QLatin1String("nonexistent")));
+
+    const QHash<QString, quint32> durations = log.targetDurations();
+    QCOMPARE(durations.count(), 2);
+    QCOMPARE(durations.value(QLatin1String("foo.obj")), 500u);
+    QVERIFY(!durations.contains(QLatin1String("bar.obj")));
+
+    QList<Command> commands;
+    commands.append(Command());
+    commands.last().m_commandLine = QLatin1String("cl /c foo.cpp");
+    const quint64 hash = BuildLog::hashCommands(commands);
+    QCOMPARE(BuildLog::hashCommands(commands), hash);
+    commands.last().m_commandLine = QLatin1String("cl /c /O2 foo.cpp");
+    QVERIFY(BuildLog::hashCommands(commands) != hash);
+
+    const QStringList dependents = QStringList() << QLatin1String("foo.cpp");
+    const quint64 targetHash = BuildLog::hashTargetCommands(hash, QLatin1String("foo.obj"), dependents);
+    QCOMPARE(BuildLog::hashTargetCommands(hash, QLatin1String("foo.obj"), dependents), targetHash);
+    QVERIFY(BuildLog::hashTargetCommands(hash, QLatin1String("bar.obj"), dependents) != targetHash);
+    QVERIFY(BuildLog::hashTargetCommands(hash, QLatin1String("foo.obj"), QStringList()) != targetHash);
+}
+
+void Tests::fileInfoCache()
+{
+    QTemporaryDir tempDir;
+    QVERIFY(tempDir.isValid());
+    const QString fileName = QDir::toNativeSeparators(tempDir.path() + QLatin1String("/foo.txt"));
+    const QString otherFileName = QDir::toNativeSeparators(tempDir.path() + QLatin1String("/bar.txt"));
+    QVERIFY(!FastFileInfo(fileName).exists());
+
+    // The directory has been read. Missing files are answered from the cache.
+    QFile file(fileName);
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    file.close();
+    QVERIFY(!FastFileInfo(fileName).exists());
+
+    // Invalidating any file of the directory invalidates the whole directory.
+    FastFileInfo::clearCacheForFile(otherFileName);
+    FastFileInfo fi(fileName);
+    QVERIFY(fi.exists());
+    QVERIFY(fi.lastModified().isValid());
+
+    // Misses are not final in a directory that has been written.
+    QVERIFY(writeFile(otherFileName, QByteArray()));
+    QVERIFY(FastFileInfo(otherFileName).exists());
+
+    // Relative and absolute spellings of a directory share the cache entry.
+    QVERIFY(QDir(tempDir.path()).mkdir(QLatin1String("sub")));
+    const QString subFileName = tempDir.path() + QLatin1String("/sub/foo.txt");
+    const QString relativeSubFileName = QDir::current().relativeFilePath(subFileName);
+    QVERIFY(!FastFileInfo(relativeSubFileName).exists());
+    QVERIFY(writeFile(subFileName, QByteArray()));
+    FastFileInfo::clearCacheForFile(subFileName);
+    QVERIFY(FastFileInfo(relativeSubFileName).exists());
+}
+
+void Tests::fileInfoCacheWildcards()
+{
+    QTemporaryDir tempDir;
+    QVERIFY(tempDir.isValid());
+    const QString dirPath = tempDir.path();
+    QVERIFY(writeFile(dirPath + QLatin1String("/b.cpp"), QByteArray()));
+    QVERIFY(writeFile(dirPath + QLatin1String("/c.h"), QByteArray()));
+
+    // Wildcards match case-insensitively.
+    QCOMPARE(FastFileInfo::findFiles(dirPath, QLatin1String("*.CPP")),
+             QStringList() << QLatin1String("b.cpp"));
+
+    // The directory listing is cached. A new file is not seen...
+    QVERIFY(writeFile(dirPath + QLatin1String("/a.cpp"), QByteArray()));
+    QCOMPARE(FastFileInfo::findFiles(dirPath, QLatin1String("*.cpp")),
+             QStringList() << QLatin1String("b.cpp"));
+
+    // ...until the cache of the directory is cleared.
+    FastFileInfo::clearCacheForFile(dirPath + QLatin1String("/a.cpp"));
+    QCOMPARE(FastFileInfo::findFiles(dirPath, QLatin1String("*.cpp")),
+             QStringList() << QLatin1String("a.cpp") << QLatin1String("b.cpp"));
+}
+
+void Tests::fileInfoCacheLargeDirectory()
+{
+    // Large directories are stat'ed in batches, e.g. through io_uring on Linux.
+    QTemporaryDir tempDir;
+    QVERIFY(tempDir.isValid());
+    const QString dirPath = tempDir.path();
+    const int fileCount = 40;
+    for (int i = 0; i < fileCount; ++i) {
+        const QString fileName = dirPath + QString::fromLatin1("/file%1.txt").arg(i);
+        QVERIFY(writeFile(fileName, QByteArray(i, 'x')));
+    }
+    QVERIFY(QDir(dirPath).mkdir(QLatin1String("sub")));
+
+    QCOMPARE(FastFileInfo::findFiles(dirPath, QLatin1String("*.txt")).count(), fileCount);
+    for (int i = 0; i < fileCount; ++i) {
+        const FastFileInfo fi(dirPath + QString::fromLatin1("/file%1.txt").arg(i));
+        QVERIFY(fi.exists());
+        QVERIFY(fi.lastModified().isValid());
+        QCOMPARE(fi.size(), qint64(i));
+    }
+    QVERIFY(FastFileInfo(dirPath + QLatin1String("/sub")).exists());
+    QVERIFY(!FastFileInfo(dirPath + QLatin1String("/missing.txt")).exists());
+}
+
+namespace {
+
+class FileInfoLookupTask : public QRunnable
+{
+public:
+    FileInfoLookupTask(const QStringList &fileNames, QAtomicInt *missingCount)
+        : m_fileNames(fileNames), m_missingCount(missingCount)
+    {
+    }
+
+    void run()
+    {
+        for (int i = 0; i < 100; ++i) {
+            foreach (const QString &fileName, m_fileNames) {
+                if (!FastFileInfo(fileName).exists())
+                    m_missingCount->ref();
+                if (i % 10 == 0)
+                    FastFileInfo::clearCacheForFile(fileName);
+            }
+        }
+    }
+
+private:
+    const QStringList m_fileNames;
+    QAtomicInt *const m_missingCount;
+};
+
+} // anonymous namespace
+
+void Tests::concurrentFileInfoCache()
+{
+    QTemporaryDir tempDir;
+    QVERIFY(tempDir.isValid());
+    QStringList fileNames;
+    for (int i = 0; i < 8; ++i) {
+        const QString dirPath = tempDir.path() + QLatin1String("/dir") + QString::number(i);
+        QVERIFY(QDir().mkpath(dirPath));
+        for (int k = 0; k < 8; ++k) {
+            const QString fileName = dirPath + QLatin1String("/file") + QString::number(k);
+            QFile file(fileName);
+            QVERIFY(file.open(QIODevice::WriteOnly));
+            fileNames.append(QDir::toNativeSeparators(fileName));
+        }
+    }
+
+    // Lookups and invalidations from several threads must not interfere.
+    QAtomicInt missingCount;
+    QThreadPool threadPool;
+    threadPool.setMaxThreadCount(8);
+    for (int i = 0; i < 8; ++i)
+        threadPool.start(new FileInfoLookupTask(fileNames, &missingCount));
+    threadPool.waitForDone();
+    QCOMPARE(missingCount.load(), 0);
+
+    const QString lateFileName = QDir::toNativeSeparators(tempDir.path() + QLatin1String("/dir0/late"));
+    QVERIFY(!FastFileInfo(lateFileName).exists());
+    QFile lateFile(lateFileName);
+    QVERIFY(lateFile.open(QIODevice::WriteOnly));
+    lateFile.close();
+    FastFileInfo::clearCacheForFile(lateFileName);
+    QVERIFY(FastFileInfo(lateFileName).exists());
+}
+
 void Tests::touchFile(const QString &fileName)
 {
     QFile file(fileName);
     QVERIFY(file.exists());
-    file.open(QFile::WriteOnly);
+    file.open(QFile::ReadWrite);
     const qint64 s = file.size();
     file.resize(s + 1);
     file.resize(s);
 }
 
+void Tests::makefileCache()
+{
+    QTemporaryDir tempDir;
+    QVERIFY(tempDir.isValid());
+    const QString fileName = tempDir.path() + QLatin1String("/test.mk");
+    {
+        QFile file(fileName);
+        QVERIFY(file.open(QFile::WriteOnly));
+        file.write("CFLAGS = /O2\n"
+                   ".c.obj:\n"
+                   "\tcl $(CFLAGS) /c $<\n"
+                   "all: foo.obj\n"
+                   "\t@echo done\n"
+                   ".PRECIOUS: all\n");
+    }
+
+    // /NOMAKEFILECACHE doesn't write a snapshot.
+    const QStringList arguments = QStringList() << QLatin1String("/F") << fileName;
+    MakefileCache cache(fileName, MakefileCache::createKey(arguments, ProcessEnvironment()));
+    QVERIFY(m_makefileFactory->apply(QStringList(arguments) << QLatin1String("/NOMAKEFILECACHE")));
+    delete m_makefileFactory->makefile();
+    QVERIFY(!QFile::exists(cache.fileName()));
+
+    // Parsing the makefile writes the snapshot.
+    QVERIFY(m_makefileFactory->apply(arguments));
+    QScopedPointer<Makefile> parsedMakefile(m_makefileFactory->makefile());
+    QVERIFY(parsedMakefile);
+    QVERIFY(QFile::exists(cache.fileName()));
+
+    Options options;
+    MacroTable macroTable;
+    {
+        Makefile makefile(fileName);
+        makefile.setOptions(&options);
+        makefile.setMacroTable(&macroTable);
+        QVERIFY(cache.load(&makefile, &macroTable, ProcessEnvironment()));
+        QCOMPARE(macroTable.macroValue(QLatin1String("CFLAGS")), QLatin1String("/O2"));
+        QCOMPARE(makefile.targets().count(), parsedMakefile->targets().count());
+        QCOMPARE(makefile.preciousTargets(), QStringList() << QLatin1String("all"));
+
+        DescriptionBlock *target = makefile.firstTarget();
+        QVERIFY(target);
+        QCOMPARE(target->targetName(), QLatin1String("all"));
+        QCOMPARE(target->m_dependents, QStringList() << QLatin1String("foo.obj"));
+        QCOMPARE(target->m_commands.count(), 1);
+        QCOMPARE(target->m_commands.first().m_commandLine, QLatin1String("echo done"));
+        QVERIFY(target->m_commands.first().m_silent);
+
+        target = makefile.target(QLatin1String("foo.obj"));
+        QVERIFY(target);
+        QCOMPARE(target->m_inferenceRules.count(), 1);
+        QCOMPARE(target->m_inferenceRules.first()->name(), QLatin1String(".c.obj"));
+    }
+
+    // Other arguments share the snapshot file, but don't use the snapshot.
+    {
+        MakefileCache otherCache(fileName, MakefileCache::createKey(
+                                     QStringList(arguments) << QLatin1String("/N"),
+                                     ProcessEnvironment()));
+        QCOMPARE(otherCache.fileName(), cache.fileName());
+        Makefile makefile(fileName);
+        makefile.setOptions(&options);
+        makefile.setMacroTable(&macroTable);
+        QVERIFY(!otherCache.load(&makefile, &macroTable, ProcessEnvironment()));
+        QVERIFY(makefile.targets().isEmpty());
+    }
+
+    // A changed makefile invalidates the snapshot. The input files are stat'ed
+    // directly, so the FastFileInfo cache doesn't hide the change.
+    QVERIFY(FastFileInfo(fileName).exists());
+    {
+        QFile file(fileName);
+        QVERIFY(file.open(QFile::WriteOnly | QFile::Append));
+        file.write("# changed\n");
+    }
+    Makefile makefile(fileName);
+    makefile.setOptions(&options);
+    makefile.setMacroTable(&macroTable);
+    QVERIFY(!cache.load(&makefile, &macroTable, ProcessEnvironment()));
+    QVERIFY(makefile.targets().isEmpty());
+}
+
 QList<QByteArray> Tests::splitOutput(const QByteArray &output)
 {
     QList<QByteArray> result = output.split('\n');
@@ -1043,6 +1703,8 @@ void Tests::buildUnrelatedTargetsOnError()
     QVERIFY(err.contains("jom: Option /K specified. Continuing."));
     QVERIFY(err.contains("jom: Target 'dependsOnFailingTarget' "
                          "cannot be built due to failed dependencies."));
+    QVERIFY(!err.contains("jom: Target 'noMatchingInferenceRule.obj' "
+                          "cannot be built due to failed dependencies."));
 }
 
 void Tests::caseInsensitiveDependents()
@@ -1220,9 +1882,130 @@ void Tests::nonexistentDependent()
     QVERIFY(output.contains("yo ho ho ho"));
 }
 
+void Tests::contentHash()
+{
+    QVERIFY(runJom(QStringList() << "/nologo" << "/j1" << "/sequentialtargets" << "/contenthash"
+                                 << "/f" << "test.mk" << "clean" << "all",
+            "blackbox/contentHash"));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    QStringList output = readJomStdOutput();
+    QCOMPARE(output.takeFirst(), QLatin1String("output.txt"));
+    QVERIFY(output.isEmpty());
+
+    // Touching the dependent without changing its contents doesn't trigger a rebuild.
+    touchFile("blackbox/contentHash/input.txt");
+    QVERIFY(runJom(QStringList() << "/nologo" << "/j1" << "/contenthash" << "/f" << "test.mk",
+            "blackbox/contentHash"));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    output = readJomStdOutput();
+    QVERIFY(output.isEmpty());
+
+    QFile file("blackbox/contentHash/input.txt");
+    QVERIFY(file.open(QFile::WriteOnly | QFile::Append));
+    file.write("changed\r\n");
+    file.close();
+    QVERIFY(runJom(QStringList() << "/nologo" << "/j1" << "/contenthash" << "/f" << "test.mk",
+            "blackbox/contentHash"));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    output = readJomStdOutput();
+    QCOMPARE(output.takeFirst(), QLatin1String("output.txt"));
+    QVERIFY(output.isEmpty());
+}
+
+void Tests::contentHashInferenceRules()
+{
+    QVERIFY(runJom(QStringList() << "/nologo" << "/j1" << "/sequentialtargets"
+                                 << "/f" << "inference.mk" << "clean" << "all",
+            "blackbox/contentHash"));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    QStringList output = readJomStdOutput();
+    QCOMPARE(output.takeFirst(), QLatin1String("inferred.out"));
+    QVERIFY(output.isEmpty());
+
+    // The up-to-date target is recorded together with its inferred dependent.
+    QVERIFY(runJom(QStringList() << "/nologo" << "/j1" << "/contenthash" << "/f" << "inference.mk",
+            "blackbox/contentHash"));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    output = readJomStdOutput();
+    QVERIFY(output.isEmpty());
+
+    touchFile("blackbox/contentHash/inferred.txt");
+    QVERIFY(runJom(QStringList() << "/nologo" << "/j1" << "/contenthash" << "/f" << "inference.mk",
+            "blackbox/contentHash"));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    output = readJomStdOutput();
+    QVERIFY(output.isEmpty());
+
+    QFile file("blackbox/contentHash/inferred.txt");
+    QVERIFY(file.open(QFile::WriteOnly | QFile::Append));
+    file.write("changed\r\n");
+    file.close();
+    QVERIFY(runJom(QStringList() << "/nologo" << "/j1" << "/contenthash" << "/f" << "inference.mk",
+            "blackbox/contentHash"));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    output = readJomStdOutput();
+    QCOMPARE(output.takeFirst(), QLatin1String("inferred.out"));
+    QVERIFY(output.isEmpty());
+}
+
+void Tests::restat()
+{
+    QVERIFY(runJom(QStringList() << "/nologo" << "/j1" << "/sequentialtargets"
+                                 << "/f" << "test.mk" << "clean" << "all",
+            "blackbox/restat"));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    QStringList output = readJomStdOutput();
+    QCOMPARE(output.takeFirst(), QLatin1String("generated.h"));
+    QCOMPARE(output.takeFirst(), QLatin1String("output.txt"));
+    QVERIFY(output.isEmpty());
+
+    // The generator runs, but leaves generated.h alone. output.txt stays up-to-date.
+    touchFile("blackbox/restat/input.txt");
+    QVERIFY(runJom(QStringList() << "/nologo" << "/j1" << "/f" << "test.mk",
+            "blackbox/restat"));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    output = readJomStdOutput();
+    QCOMPARE(output.takeFirst(), QLatin1String("generated.h"));
+    QVERIFY(output.isEmpty());
+
+    // The result of the .RESTAT check is remembered in the build log.
+    QVERIFY(runJom(QStringList() << "/nologo" << "/j1" << "/f" << "test.mk",
+            "blackbox/restat"));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    output = readJomStdOutput();
+    QVERIFY(output.isEmpty());
+}
+
+void Tests::commandChange()
+{
+    QVERIFY(runJom(QStringList() << "/nologo" << "/j1" << "/sequentialtargets"
+                                 << "/f" << "test.mk" << "clean" << "all",
+            "blackbox/commandChange"));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    QStringList output = readJomStdOutput();
+    QCOMPARE(output.takeFirst(), QLatin1String("output.txt a"));
+    QVERIFY(output.isEmpty());
+
+    QVERIFY(runJom(QStringList() << "/nologo" << "/j1" << "/f" << "test.mk",
+            "blackbox/commandChange"));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    output = readJomStdOutput();
+    QVERIFY(output.isEmpty());
+
+    // Changing a macro that is used in the commands triggers a rebuild.
+    QVERIFY(runJom(QStringList() << "/nologo" << "/j1" << "/f" << "test.mk" << "FLAGS=b",
+            "blackbox/commandChange"));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    output = readJomStdOutput();
+    QCOMPARE(output.takeFirst(), QLatin1String("jom: Rebuilding output.txt because its commands changed."));
+    QCOMPARE(output.takeFirst(), QLatin1String("output.txt b"));
+    QVERIFY(output.isEmpty());
+}
+
 void Tests::outOfDateCheck()
 {
-    QVERIFY(runJom(QStringList() << "/nologo" << "/j1" << "/f" << "test.mk" << "clean" << "all",
+    QVERIFY(runJom(QStringList() << "/nologo" << "/j1" << "/sequentialtargets"
+                                 << "/f" << "test.mk" << "clean" << "all",
             "blackbox/outofdatecheck"));
     QCOMPARE(m_jomProcess->exitCode(), 0);
     QStringList output = readJomStdOutput();
@@ -1283,4 +2066,35 @@ void Tests::outOfDateCheck()
     QVERIFY(output.isEmpty());
 }
 
+void Tests::criticalPathScheduling()
+{
+    QVERIFY(runJom(QStringList() << "/nologo" << "/j1" << "/f" << "test.mk",
+            "blackbox/criticalPath"));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    QStringList output = readJomStdOutput();
+    QCOMPARE(output, QStringList() << "a" << "c" << "b");
+
+    QVERIFY(runJom(QStringList() << "/nologo" << "/j1" << "/criticalpath" << "/f" << "test.mk",
+            "blackbox/criticalPath"));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    output = readJomStdOutput();
+    QCOMPARE(output, QStringList() << "c" << "a" << "b");
+}
+
+void Tests::multipleCommandLineTargets()
+{
+    QVERIFY(runJom(QStringList() << "/nologo" << "/j1" << "/f" << "test.mk" << "a" << "b",
+            "blackbox/multipleTargets"));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    QStringList output = readJomStdOutput();
+    QCOMPARE(output, QStringList() << "shared" << "a" << "b");
+
+    QVERIFY(runJom(QStringList() << "/nologo" << "/j1" << "/sequentialtargets"
+                                 << "/f" << "test.mk" << "a" << "b",
+            "blackbox/multipleTargets"));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    output = readJomStdOutput();
+    QCOMPARE(output, QStringList() << "shared" << "a" << "shared" << "b");
+}
+
 QTEST_MAIN(Tests)
@@ -41,7 +41,10 @@ private slots:
     // preprocessor tests
     void includeFiles();
     void includeCycle();
+    void includeFileCache();
+    void lineReader();
     void macros();
+    void macroExpansionCache();
     void invalidMacros_data();
     void invalidMacros();
     void preprocessorExpressions_data();
@@ -50,15 +53,18 @@ private slots:
     void preprocessorInvalidExpressions_data();
     void preprocessorInvalidExpressions();
     void conditionals();
+    void tokenizer();
     void dotDirectives();
 
     // parser tests
     void descriptionBlocks();
     void inferenceRules_data();
     void inferenceRules();
+    void batchModeRules();
     void cycleInTargets();
     void dependentsWithSpace();
     void multipleTargets();
+    void dependentTargets();
     void commandModifiers();
     void comments();
     void fileNameMacros();
@@ -66,6 +72,19 @@ private slots:
     void wildcardsInDependencies();
     void windowsPathsInTargetName();
 
+    // dependency graph tests
+    void pruneUpToDateSubgraphs();
+
+    // build log tests
+    void buildLog();
+    void makefileCache();
+
+    // file info cache tests
+    void fileInfoCache();
+    void fileInfoCacheWildcards();
+    void fileInfoCacheLargeDirectory();
+    void concurrentFileInfoCache();
+
     // black-box tests
     void buildUnrelatedTargetsOnError();
     void caseInsensitiveDependents();
@@ -82,6 +101,12 @@ private slots:
     void suffixes();
     void nonexistentDependent();
     void outOfDateCheck();
+    void contentHash();
+    void contentHashInferenceRules();
+    void restat();
+    void commandChange();
+    void criticalPathScheduling();
+    void multipleCommandLineTargets();
 
 private:
     bool openMakefile(const QString& fileName);